@@ -1,4 +1,7 @@
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "arena.h"
 #include "kette.h"
@@ -6,10 +9,34 @@
 
 #define INITIAL_BYTES_DEFAULT page_size()
 #define BYTES_GROWTH_DEFAULT page_size()
+// Keep large allocations 16 byte aligned like malloc
+#define LARGE_HEADER_SIZE ((sizeof(struct arena_large) + 15) & ~(size_t)15)
 
+static __thread struct arena *scratch_arenas[ARENA_SCRATCH_NUM];
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void arena_init(struct arena *arena, size_t bytes_growth,
+		       unsigned int flags, size_t page_size);
+static size_t profile_initial_bytes(struct arena_profile *profile);
+static void profile_record(struct arena_profile *profile, size_t peak);
+static void scratch_key_create();
+static void scratch_free(void *arenas);
 static void arena_page_init(struct arena *arena, struct arena_page *page,
 			    size_t struct_size, size_t page_size);
+static struct arena_page *take_free_page(struct arena *arena);
+static void put_page(struct arena *arena, struct arena_page *page,
+		     size_t page_bytes);
 static void *alloc_in_page(struct arena_page *page, size_t bytes);
+static inline int is_large(struct arena *arena, size_t bytes);
+static void *alloc_large(struct arena *arena, size_t bytes);
+static struct arena_large *take_free_large(struct arena *arena,
+					   size_t num_pages);
+static void *realloc_large(void *ptr, size_t bytes, size_t *usable);
+static int iovec_walk(struct arena *arena, struct iovec *iov, int iovcnt,
+		      int num);
+static void iovec_add(struct iovec *iov, int iovcnt, int *i, uintptr_t base,
+		      size_t len);
 static size_t bytes_to_page(size_t bytes, int page_size);
 
 struct arena *arena_create()
@@ -25,55 +52,470 @@ struct arena *arena_create_ext(size_t initial_bytes, size_t bytes_growth)
 	if (a == NULL) {
 		return NULL;
 	}
-	slist_init(&a->head);
-	a->bytes_growth = bytes_growth;
-	arena_page_init(a, &a->page, sizeof(*a), num_pages * ps);
+	arena_init(a, bytes_growth, 0, num_pages * ps);
+	return a;
+}
+
+struct arena *arena_create_in(void *buf, size_t len, size_t bytes_growth)
+{
+	uintptr_t start = (uintptr_t)buf;
+	uintptr_t aligned = (start + _Alignof(struct arena) - 1) &
+			    ~(uintptr_t)(_Alignof(struct arena) - 1);
+	if (buf == NULL || aligned + sizeof(struct arena) >= start + len) {
+		errno = EINVAL;
+		return NULL;
+	}
+	struct arena *a = (struct arena *)aligned;
+	arena_init(a, bytes_growth, ARENA_EXTERNAL, start + len - aligned);
+	return a;
+}
+
+struct arena *arena_create_child(struct arena *parent)
+{
+	size_t ps = page_size();
+	size_t page_bytes = bytes_to_page(parent->bytes_growth, ps) * ps;
+	struct arena *a = (struct arena *)take_free_page(parent);
+	if (a == NULL) {
+		a = palloc(page_bytes / ps);
+		if (a == NULL) {
+			return NULL;
+		}
+	}
+	arena_init(a, parent->bytes_growth, 0, page_bytes);
+	a->parent = parent;
+	++parent->children;
+	return a;
+}
+
+struct arena *arena_create_profiled(struct arena_profile *profile)
+{
+	size_t growth = profile->bytes_growth;
+	if (growth == 0) {
+		growth = BYTES_GROWTH_DEFAULT;
+	}
+	struct arena *a =
+		arena_create_ext(profile_initial_bytes(profile), growth);
+	if (a != NULL) {
+		a->profile = profile;
+	}
 	return a;
 }
 
 void *arena_alloc(struct arena *arena, size_t bytes)
 {
+	// Big objects always get their own span, even if they would fit in
+	// the current page, so arena_free_large works on anything this big
+	if (is_large(arena, bytes)) {
+		return alloc_large(arena, bytes);
+	}
 	struct arena_page *curr_page =
 		list_entry(arena->head.next, struct arena_page, pages_head);
 	size_t bytes_left = curr_page->end - curr_page->idx - 1;
 	if (bytes <= bytes_left) {
 		return alloc_in_page(curr_page, bytes);
 	}
-	size_t growth = bytes >= arena->bytes_growth ? bytes :
-						       arena->bytes_growth;
+	// Anything left fits in a growth sized page, so every new page is
+	// one the cache can take back
 	size_t ps = page_size();
-	size_t num_pages = bytes_to_page(growth, ps);
-	curr_page = palloc(num_pages);
+	size_t num_pages = bytes_to_page(arena->bytes_growth, ps);
+	curr_page = take_free_page(arena);
 	if (curr_page == NULL) {
-		return NULL;
+		curr_page = palloc(num_pages);
+		if (curr_page == NULL) {
+			return NULL;
+		}
 	}
 	arena_page_init(arena, curr_page, sizeof(*curr_page), num_pages * ps);
-	return alloc_in_page(curr_page, growth);
+	return alloc_in_page(curr_page, bytes);
+}
+
+struct arena_mark arena_mark(struct arena *arena)
+{
+	struct arena_page *curr_page =
+		list_entry(arena->head.next, struct arena_page, pages_head);
+	struct arena_mark mark = {
+		.page = arena->head.next,
+		.idx = curr_page->idx,
+		.seq = arena->seq,
+	};
+	return mark;
+}
+
+void arena_rewind(struct arena *arena, struct arena_mark mark)
+{
+	// Newer pages are always nearer the head. Pages merged in from
+	// another arena are stepped over and stay where they are.
+	struct slink *prev = &arena->head;
+	while (prev->next != mark.page) {
+		struct slink *s = prev->next;
+		struct arena_page *page =
+			list_entry(s, struct arena_page, pages_head);
+		if (page->seq == 0) {
+			prev = s;
+			continue;
+		}
+		prev->next = s->next;
+		put_page(arena, page, page->end - (uintptr_t)page);
+	}
+	list_entry(mark.page, struct arena_page, pages_head)->idx = mark.idx;
+	// Large allocations are newest first too, apart from merged ones.
+	// Going by seq rather than by node means one freed early can't be
+	// missed.
+	struct dlink *next;
+	for (struct dlink *l = arena->large_head.next; l != &arena->large_head;
+	     l = next) {
+		next = l->next;
+		struct arena_large *large =
+			list_entry(l, struct arena_large, large_head);
+		if (large->seq == 0) {
+			continue;
+		}
+		if (large->seq < mark.seq) {
+			break;
+		}
+		dlist_del(l);
+		dlist_add(l, &arena->free_large);
+	}
+}
+
+struct arena_scratch arena_scratch_begin(struct arena *conflict)
+{
+	struct arena_scratch scratch = { 0 };
+	for (int i = 0; i < ARENA_SCRATCH_NUM; ++i) {
+		if (scratch_arenas[i] == NULL) {
+			pthread_once(&scratch_key_once, scratch_key_create);
+			scratch_arenas[i] = arena_create();
+			if (scratch_arenas[i] == NULL) {
+				return scratch;
+			}
+			pthread_setspecific(scratch_key, scratch_arenas);
+		}
+		if (scratch_arenas[i] != conflict) {
+			scratch.arena = scratch_arenas[i];
+			scratch.mark = arena_mark(scratch.arena);
+			return scratch;
+		}
+	}
+	return scratch;
+}
+
+void arena_scratch_end(struct arena_scratch scratch)
+{
+	if (scratch.arena == NULL) {
+		return;
+	}
+	arena_rewind(scratch.arena, scratch.mark);
+}
+
+void arena_set_large_threshold(struct arena *arena, size_t bytes)
+{
+	if (bytes > arena->bytes_growth) {
+		bytes = arena->bytes_growth;
+	}
+	arena->large_threshold = bytes;
+}
+
+void arena_free_large(void *ptr)
+{
+	struct arena_large *large =
+		(struct arena_large *)((uintptr_t)ptr - LARGE_HEADER_SIZE);
+	dlist_del(&large->large_head);
+	pfree(large);
 }
 
 void arena_free(struct arena *arena)
 {
-	// This is the page arena is allocated on
-	struct arena_page *free_last =
+	// Pages in the free cache were in use before a rewind so they count
+	// towards the peak too
+	size_t peak = 0;
+	if (arena->profile != NULL) {
+		struct arena_page *entry;
+		list_for_each(&arena->head, entry, struct arena_page,
+			      pages_head) {
+			peak += entry->idx - entry->start;
+		}
+		list_for_each(&arena->free_pages, entry, struct arena_page,
+			      pages_head) {
+			peak += entry->end - entry->start;
+		}
+		profile_record(arena->profile, peak);
+	}
+	struct dlink *lists[] = { &arena->large_head, &arena->free_large };
+	for (int i = 0; i < 2; ++i) {
+		struct dlink *lnext;
+		for (struct dlink *l = lists[i]->next; l != lists[i]; l = lnext) {
+			lnext = l->next;
+			pfree(list_entry(l, struct arena_large, large_head));
+		}
+	}
+	// Grab next before freeing each page. The page the arena is
+	// allocated on is freed last since it holds the list heads.
+	struct slink *next;
+	for (struct slink *s = arena->free_pages.next; s != &arena->free_pages;
+	     s = next) {
+		next = s->next;
+		struct arena_page *page =
+			list_entry(s, struct arena_page, pages_head);
+		put_page(arena->parent, page, page->end - (uintptr_t)page);
+	}
+	for (struct slink *s = arena->head.next; s != &arena->head; s = next) {
+		next = s->next;
+		if (s != &arena->page.pages_head) {
+			struct arena_page *page =
+				list_entry(s, struct arena_page, pages_head);
+			put_page(arena->parent, page,
+				 page->end - (uintptr_t)page);
+		}
+	}
+	if (arena->parent != NULL) {
+		--arena->parent->children;
+	}
+	if (!(arena->flags & ARENA_EXTERNAL)) {
+		put_page(arena->parent, &arena->page,
+			 arena->page.end - (uintptr_t)arena);
+	}
+}
+
+int arena_merge(struct arena *dst, struct arena *src)
+{
+	// The buffer src lives in is not ours to hand over
+	if (src->flags & ARENA_EXTERNAL) {
+		errno = EINVAL;
+		return -1;
+	}
+	// Children would hand their pages back to src once it's gone
+	if (src->children != 0) {
+		errno = EBUSY;
+		return -1;
+	}
+	// src's pages go in front of dst's as they are, so src's current
+	// page is dst's from now on. Tag them on the way to src's tail.
+	struct slink *first = src->head.next;
+	struct slink *last = first;
+	for (;;) {
+		list_entry(last, struct arena_page, pages_head)->seq = 0;
+		if (last->next == &src->head) {
+			break;
+		}
+		last = last->next;
+	}
+	last->next = dst->head.next;
+	dst->head.next = first;
+	// Same for the large allocations
+	if (!list_empty(&src->large_head)) {
+		struct arena_large *entry;
+		list_for_each(&src->large_head, entry, struct arena_large,
+			      large_head) {
+			entry->seq = 0;
+		}
+		struct dlink *large = src->large_head.next;
+		dlist_del(&src->large_head);
+		dlist_splice(large, &dst->large_head);
+	}
+	if (!list_empty(&src->free_large)) {
+		struct dlink *large = src->free_large.next;
+		dlist_del(&src->free_large);
+		dlist_splice(large, &dst->free_large);
+	}
+	// Only dst's growth size may go in dst's cache
+	size_t ps = page_size();
+	size_t page_bytes = bytes_to_page(dst->bytes_growth, ps) * ps;
+	while (!list_empty(&src->free_pages)) {
+		struct slink *s = src->free_pages.next;
+		src->free_pages.next = s->next;
+		struct arena_page *page =
+			list_entry(s, struct arena_page, pages_head);
+		size_t bytes = page->end - (uintptr_t)page;
+		if (bytes == page_bytes) {
+			slist_add(s, &dst->free_pages);
+		} else {
+			put_page(src->parent, page, bytes);
+		}
+	}
+	if (src->parent != NULL) {
+		--src->parent->children;
+	}
+	return 0;
+}
+
+int arena_iovec(struct arena *arena, struct iovec *iov, int iovcnt)
+{
+	// Everything is listed newest first, so count it, then fill from the
+	// back
+	int num = iovec_walk(arena, NULL, 0, 0);
+	iovec_walk(arena, iov, iovcnt, num);
+	return num;
+}
+
+void arena_vec_init(struct arena_vec *vec, struct arena *arena,
+		    size_t elem_size)
+{
+	vec->data = NULL;
+	vec->len = 0;
+	vec->cap = 0;
+	vec->elem_size = elem_size;
+	vec->arena = arena;
+	vec->large = 0;
+}
+
+int arena_vec_reserve(struct arena_vec *vec, size_t cap)
+{
+	if (cap <= vec->cap) {
+		return 0;
+	}
+	struct arena *arena = vec->arena;
+	size_t bytes = cap * vec->elem_size;
+	size_t old_bytes = vec->cap * vec->elem_size;
+	size_t usable;
+	if (vec->large) {
+		void *data = realloc_large(vec->data, bytes, &usable);
+		if (data == NULL) {
+			return -1;
+		}
+		vec->data = data;
+		vec->cap = usable / vec->elem_size;
+		return 0;
+	}
+	struct arena_page *curr_page =
 		list_entry(arena->head.next, struct arena_page, pages_head);
-	struct arena_page *entry;
-	list_for_each(&arena->head, entry, struct arena_page, pages_head) {
-		if (entry != free_last) {
-			pfree(entry);
+	int is_last = vec->data != NULL &&
+		      (uintptr_t)vec->data + old_bytes == curr_page->idx;
+	if (!is_large(arena, bytes) && is_last &&
+	    bytes - old_bytes <= curr_page->end - curr_page->idx - 1) {
+		alloc_in_page(curr_page, bytes - old_bytes);
+		vec->cap = cap;
+		return 0;
+	}
+	void *data;
+	if (is_large(arena, bytes)) {
+		data = alloc_large(arena, bytes);
+		vec->large = data != NULL;
+	} else {
+		data = arena_alloc(arena, bytes);
+	}
+	if (data == NULL) {
+		return -1;
+	}
+	memcpy(data, vec->data, vec->len * vec->elem_size);
+	// Give the old space back if nothing was allocated after it
+	if (is_last) {
+		curr_page->idx -= old_bytes;
+	}
+	vec->data = data;
+	vec->cap = cap;
+	return 0;
+}
+
+static void arena_init(struct arena *arena, size_t bytes_growth,
+		       unsigned int flags, size_t page_size)
+{
+	slist_init(&arena->head);
+	dlist_init(&arena->large_head);
+	slist_init(&arena->free_pages);
+	dlist_init(&arena->free_large);
+	arena->bytes_growth = bytes_growth;
+	arena->large_threshold = bytes_growth;
+	arena->flags = flags;
+	arena->parent = NULL;
+	arena->children = 0;
+	arena->seq = 1;
+	arena->profile = NULL;
+	arena_page_init(arena, &arena->page, sizeof(*arena), page_size);
+}
+
+// Size for the ARENA_PROFILE_PERCENTILE of recorded peaks
+static size_t profile_initial_bytes(struct arena_profile *profile)
+{
+	size_t peaks[ARENA_PROFILE_NUM];
+	unsigned int num = __atomic_load_n(&profile->next, __ATOMIC_RELAXED);
+	if (num > ARENA_PROFILE_NUM) {
+		num = ARENA_PROFILE_NUM;
+	}
+	if (num == 0) {
+		return INITIAL_BYTES_DEFAULT;
+	}
+	// Insertion sort, there are only a handful of peaks
+	for (unsigned int i = 0; i < num; ++i) {
+		size_t peak = __atomic_load_n(&profile->peaks[i],
+					      __ATOMIC_RELAXED);
+		unsigned int j = i;
+		for (; j > 0 && peaks[j - 1] > peak; --j) {
+			peaks[j] = peaks[j - 1];
+		}
+		peaks[j] = peak;
+	}
+	size_t idx = (num - 1) * ARENA_PROFILE_PERCENTILE / 100;
+	return peaks[idx] + sizeof(struct arena) + 1;
+}
+
+static void profile_record(struct arena_profile *profile, size_t peak)
+{
+	unsigned int slot =
+		__atomic_fetch_add(&profile->next, 1, __ATOMIC_RELAXED);
+	// Keep next from wrapping back below ARENA_PROFILE_NUM
+	if (slot >= 2 * ARENA_PROFILE_NUM) {
+		__atomic_fetch_sub(&profile->next, ARENA_PROFILE_NUM,
+				   __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&profile->peaks[slot % ARENA_PROFILE_NUM], peak,
+			 __ATOMIC_RELAXED);
+}
+
+static void scratch_key_create()
+{
+	pthread_key_create(&scratch_key, scratch_free);
+}
+
+// Free a thread's scratch arenas when it exits
+static void scratch_free(void *arenas)
+{
+	struct arena **scratch = arenas;
+	for (int i = 0; i < ARENA_SCRATCH_NUM; ++i) {
+		if (scratch[i] != NULL) {
+			arena_free(scratch[i]);
+			scratch[i] = NULL;
 		}
 	}
-	pfree(free_last);
 }
 
 static void arena_page_init(struct arena *arena, struct arena_page *page,
 			    size_t struct_size, size_t page_size)
 {
 	uintptr_t start = (uintptr_t)page;
-	page->idx = start + struct_size;
+	page->start = start + struct_size;
+	page->idx = page->start;
 	page->end = start + page_size;
+	page->seq = arena->seq++;
 	slist_add(&page->pages_head, &arena->head);
 }
 
+// Take a growth sized page from arena's cache, or from its parents' caches
+static struct arena_page *take_free_page(struct arena *arena)
+{
+	for (; arena != NULL; arena = arena->parent) {
+		if (!list_empty(&arena->free_pages)) {
+			struct slink *s = arena->free_pages.next;
+			arena->free_pages.next = s->next;
+			return list_entry(s, struct arena_page, pages_head);
+		}
+	}
+	return NULL;
+}
+
+// Give a page back to the parent's cache if it is growth sized, otherwise
+// back to palloc
+static void put_page(struct arena *parent, struct arena_page *page,
+		     size_t page_bytes)
+{
+	size_t ps = page_size();
+	if (parent != NULL &&
+	    page_bytes == bytes_to_page(parent->bytes_growth, ps) * ps) {
+		slist_add(&page->pages_head, &parent->free_pages);
+		return;
+	}
+	pfree(page);
+}
+
 static void *alloc_in_page(struct arena_page *page, size_t bytes)
 {
 	void *ptr = (void *)page->idx;
@@ -81,6 +523,121 @@ static void *alloc_in_page(struct arena_page *page, size_t bytes)
 	return ptr;
 }
 
+// At or over the threshold, or too big for a growth sized page even when
+// it is empty
+static inline int is_large(struct arena *arena, size_t bytes)
+{
+	return bytes >= arena->large_threshold ||
+	       bytes + sizeof(struct arena_page) >= arena->bytes_growth;
+}
+
+static void *alloc_large(struct arena *arena, size_t bytes)
+{
+	size_t num_pages = bytes_to_page(bytes + LARGE_HEADER_SIZE, page_size());
+	struct arena_large *large = take_free_large(arena, num_pages);
+	if (large == NULL) {
+		large = palloc(num_pages);
+		if (large == NULL) {
+			return NULL;
+		}
+		large->page_num = num_pages;
+	}
+	struct arena_page *curr_page =
+		list_entry(arena->head.next, struct arena_page, pages_head);
+	large->bytes = bytes;
+	large->page = curr_page;
+	large->idx = curr_page->idx;
+	large->seq = arena->seq++;
+	dlist_add(&large->large_head, &arena->large_head);
+	return (void *)((uintptr_t)large + LARGE_HEADER_SIZE);
+}
+
+// The smallest cached span with at least num_pages pages, or NULL
+static struct arena_large *take_free_large(struct arena *arena,
+					   size_t num_pages)
+{
+	struct arena_large *best = NULL;
+	struct arena_large *entry;
+	list_for_each(&arena->free_large, entry, struct arena_large,
+		      large_head) {
+		if (entry->page_num >= num_pages &&
+		    (best == NULL || entry->page_num < best->page_num)) {
+			best = entry;
+		}
+	}
+	if (best != NULL) {
+		dlist_del(&best->large_head);
+	}
+	return best;
+}
+
+// Grow a large allocation in place or by moving its pages. The list node
+// lives in the span so it has to be relinked if the span moves.
+static void *realloc_large(void *ptr, size_t bytes, size_t *usable)
+{
+	struct arena_large *large =
+		(struct arena_large *)((uintptr_t)ptr - LARGE_HEADER_SIZE);
+	size_t ps = page_size();
+	size_t num_pages = bytes_to_page(bytes + LARGE_HEADER_SIZE, ps);
+	struct dlink *prev = large->large_head.prev;
+	dlist_del(&large->large_head);
+	struct arena_large *new_large = prealloc(large, num_pages);
+	if (new_large == NULL) {
+		dlist_add(&large->large_head, prev);
+		return NULL;
+	}
+	*usable = num_pages * ps - LARGE_HEADER_SIZE;
+	new_large->page_num = num_pages;
+	new_large->bytes = *usable;
+	dlist_add(&new_large->large_head, prev);
+	return (void *)((uintptr_t)new_large + LARGE_HEADER_SIZE);
+}
+
+/* Walk the used parts of the pages and the large allocations newest
+ * first, numbering them down from num and filling in the ones below
+ * iovcnt. Returns how many there are. Large allocations are grouped by the
+ * page that was current when they were made, in the same order as the
+ * pages, and each one splits its page where the page's idx was then.
+ */
+static int iovec_walk(struct arena *arena, struct iovec *iov, int iovcnt,
+		      int num)
+{
+	int i = num;
+	struct dlink *l = arena->large_head.next;
+	struct arena_page *page;
+	list_for_each(&arena->head, page, struct arena_page, pages_head) {
+		uintptr_t end = page->idx;
+		for (; l != &arena->large_head; l = l->next) {
+			struct arena_large *large =
+				list_entry(l, struct arena_large, large_head);
+			if (large->page != page) {
+				break;
+			}
+			// A vector giving back its space can leave idx below
+			uintptr_t split = large->idx < end ? large->idx : end;
+			iovec_add(iov, iovcnt, &i, split, end - split);
+			iovec_add(iov, iovcnt, &i,
+				  (uintptr_t)large + LARGE_HEADER_SIZE,
+				  large->bytes);
+			end = split;
+		}
+		iovec_add(iov, iovcnt, &i, page->start, end - page->start);
+	}
+	return num - i;
+}
+
+static void iovec_add(struct iovec *iov, int iovcnt, int *i, uintptr_t base,
+		      size_t len)
+{
+	if (len == 0) {
+		return;
+	}
+	if (--*i >= 0 && *i < iovcnt) {
+		iov[*i].iov_base = (void *)base;
+		iov[*i].iov_len = len;
+	}
+}
+
 static size_t bytes_to_page(size_t bytes, int ps)
 {
 	size_t num_pages = bytes / ps;
@@ -3,28 +3,220 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "kette.h"
 
 struct arena_page {
 	uintptr_t idx;
 	uintptr_t end;
+	// First data byte. The page an arena lives on starts after the whole
+	// arena header, and still does once arena_merge moves it to another
+	// arena.
+	uintptr_t start;
+	// Order the page became the current page in, shared with large
+	// allocations. 0 for pages merged in from another arena, which no
+	// rewind frees.
+	uint64_t seq;
 	struct slink pages_head;
 };
 
+/* Header placed at the start of every large allocation. Large allocations
+ * get their own palloc span and live on the arena's large_head list so
+ * they never become the bump target for small objects.
+ */
+struct arena_large {
+	struct dlink large_head;
+	size_t page_num;
+	// Bytes asked for
+	size_t bytes;
+	// The current page and its idx when the allocation was made, which
+	// is where it goes in allocation order
+	struct arena_page *page;
+	uintptr_t idx;
+	// Order the allocation was made in, so marks can tell which large
+	// allocations came after them. 0 for ones merged in from another
+	// arena, which no rewind frees.
+	uint64_t seq;
+};
+
+// The arena header and first page live in caller supplied memory
+#define ARENA_EXTERNAL 0x1
+
+// Number of recent peak sizes an arena_profile remembers
+#define ARENA_PROFILE_NUM 32
+// Percentile of recent peaks new arenas are sized for
+#define ARENA_PROFILE_PERCENTILE 90
+
+/* Learns how big arenas from one call site get. Arenas created from a
+ * profile record their peak size in it when freed, and new arenas start
+ * out big enough for most recent peaks. Declare one statically per call
+ * site with ARENA_PROFILE_INIT.
+ */
+struct arena_profile {
+	size_t peaks[ARENA_PROFILE_NUM];
+	unsigned int next;
+	size_t bytes_growth;
+};
+
+#define ARENA_PROFILE_INIT(growth) \
+	{                          \
+		.bytes_growth = (growth) \
+	}
+
 struct arena {
 	// !!!!!!! THIS MUST BE FIRST !!!!!!!
 	struct arena_page page;
 	struct slink head;
+	struct dlink large_head;
 	size_t bytes_growth;
+	// Allocations of this many bytes or more are given their own span
+	// instead of a page. Defaults to bytes_growth, so only objects that
+	// could never share a growth sized page get one.
+	size_t large_threshold;
+	unsigned int flags;
+	// Growth sized pages handed back by child arenas, ready for reuse
+	struct slink free_pages;
+	// Large allocations freed by rewinds, kept whole for reuse
+	struct dlink free_large;
+	// Arena this one takes growth sized pages from, or NULL
+	struct arena *parent;
+	// Live arenas created with this one as their parent
+	unsigned int children;
+	// seq of the next page or large allocation
+	uint64_t seq;
+	// Profile the peak size is recorded in on free, or NULL
+	struct arena_profile *profile;
+};
+
+/* A growable array backed by an arena. While the vector is the last
+ * allocation in the current page it is extended in place. Once it reaches
+ * the arena's large threshold it moves to its own span and grows with
+ * prealloc, so the elements are never copied again.
+ */
+struct arena_vec {
+	void *data;
+	size_t len;
+	size_t cap;
+	size_t elem_size;
+	struct arena *arena;
+	int large;
+};
+
+// A position in an arena that it can later be rewound to
+struct arena_mark {
+	struct slink *page;
+	uintptr_t idx;
+	// Pages and large allocations with this seq or later are after the
+	// mark
+	uint64_t seq;
+};
+
+// Number of thread local scratch arenas
+#define ARENA_SCRATCH_NUM 2
+
+// A scratch arena borrowed with arena_scratch_begin
+struct arena_scratch {
+	struct arena *arena;
+	struct arena_mark mark;
 };
 
 struct arena *arena_create();
 
 struct arena *arena_create_ext(size_t initial_bytes, size_t bytes_growth);
 
+// Create an arena inside buf (a stack buffer for example). The arena only
+// calls palloc once buf is full. buf must outlive the arena and
+// arena_free will not try to free it. Returns NULL if len is too small
+// to hold the arena header.
+struct arena *arena_create_in(void *buf, size_t len, size_t bytes_growth);
+
+// Create an arena whose pages come from parent's cached free pages and go
+// back to parent when it is freed. Only when parent (and its parents) have
+// no cached pages left is palloc called. The child uses parent's
+// bytes_growth for every page and must be freed before parent.
+struct arena *arena_create_child(struct arena *parent);
+
+// Create an arena sized from the recent peaks recorded in profile. The
+// arena's peak is recorded back into profile by arena_free. Safe to call
+// from many threads with the same profile.
+struct arena *arena_create_profiled(struct arena_profile *profile);
+
 void *arena_alloc(struct arena *arena, size_t bytes);
 
+struct arena_mark arena_mark(struct arena *arena);
+
+// Free everything allocated since mark was taken. Growth sized pages and
+// the spans of large allocations are kept in the arena for the next
+// allocations, so rewinding over the same pattern again never calls
+// palloc. Large allocations may have been freed early with
+// arena_free_large.
+void arena_rewind(struct arena *arena, struct arena_mark mark);
+
+// Borrow one of this thread's scratch arenas. It is never conflict, so
+// scratch memory can't overlap an arena the caller is building output in.
+// Pass NULL if there is no such arena. The scratch arenas are created on
+// first use and freed when the thread exits. If that fails the returned
+// scratch.arena is NULL, which arena_scratch_end accepts.
+struct arena_scratch arena_scratch_begin(struct arena *conflict);
+
+// Rewind a scratch arena to where it was when it was borrowed
+void arena_scratch_end(struct arena_scratch scratch);
+
+// Set the large allocation threshold. It is clamped to bytes_growth so a
+// small allocation always fits in a freshly grown page.
+void arena_set_large_threshold(struct arena *arena, size_t bytes);
+
+// Free a large allocation before the arena itself is freed. ptr MUST
+// have come from arena_alloc with bytes >= the large threshold at the
+// time, which always gives a large allocation. Anything within a page
+// header of bytes_growth is large as well.
+void arena_free_large(void *ptr);
+
 void arena_free(struct arena *arena);
 
+/* Move every page and large allocation of src into dst so objects built
+ * in src live as long as dst. Both lists are spliced in front of dst's,
+ * so src's newest page becomes dst's current page. Tagging what came from
+ * src takes one pass over each list. src is consumed and must not be used
+ * afterwards.
+ *
+ * No rewind of dst frees what came from src, whether the mark was taken
+ * before or after the merge. Rewinding past the merge leaves src's pages
+ * where they are, so dst keeps bumping after their objects, and what dst
+ * allocated in them after the merge stays until dst is freed.
+ *
+ * Pages in src's free cache go to dst's cache if they are dst's growth
+ * size and back to src's parent or palloc otherwise. Fails with EINVAL if
+ * src was created with arena_create_in and with EBUSY if src still has
+ * child arenas.
+ */
+int arena_merge(struct arena *dst, struct arena *src);
+
+// Describe the used part of each page and every large allocation in
+// allocation order so the arena's contents can be handed to writev and
+// friends without copying. Fills at most iovcnt entries and returns the
+// number needed for the whole arena. An arena_vec counts with its whole
+// capacity.
+int arena_iovec(struct arena *arena, struct iovec *iov, int iovcnt);
+
+void arena_vec_init(struct arena_vec *vec, struct arena *arena,
+		    size_t elem_size);
+
+// Make room for at least cap elements. Returns 0 on success and -1 if
+// memory could not be allocated, in which case vec is unchanged.
+int arena_vec_reserve(struct arena_vec *vec, size_t cap);
+
+// Append an element and return a pointer to it, or NULL on failure
+static inline void *arena_vec_push(struct arena_vec *vec)
+{
+	if (vec->len == vec->cap) {
+		size_t cap = vec->cap == 0 ? 8 : vec->cap * 2;
+		if (arena_vec_reserve(vec, cap) != 0) {
+			return NULL;
+		}
+	}
+	return (char *)vec->data + vec->len++ * vec->elem_size;
+}
+
 #endif // _ARENA_H
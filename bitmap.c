@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "bitmap.h"
+#include "__utils.h"
+
+typedef size_t (*find_word_fn)(const uint64_t *words, size_t nwords,
+			       size_t start);
+
+static size_t find_word_scalar(const uint64_t *words, size_t nwords,
+			       size_t start);
+#if defined(__x86_64__)
+static size_t find_word_avx2(const uint64_t *words, size_t nwords,
+			     size_t start);
+static size_t find_word_avx512(const uint64_t *words, size_t nwords,
+			       size_t start);
+#endif
+static size_t find_word_resolve(const uint64_t *words, size_t nwords,
+				size_t start);
+
+// Starts out pointing at the resolver, which replaces it on first use.
+// Threads racing on that all store the same value.
+static find_word_fn find_word = find_word_resolve;
+
+size_t bitmap_find_word(const uint64_t *words, size_t nwords, size_t start)
+{
+	find_word_fn fn = __atomic_load_n(&find_word, __ATOMIC_RELAXED);
+	return fn(words, nwords, start);
+}
+
+size_t bitmap_take(uint64_t *words, size_t nwords, size_t *start,
+		   uint32_t *out, size_t num)
+{
+	size_t taken = 0;
+	size_t i = *start;
+	while (taken < num) {
+		// Words tend to come in runs of free slots, so only go looking
+		// when the next one is empty
+		if (i < nwords && words[i] == 0) {
+			i = bitmap_find_word(words, nwords, i);
+		}
+		if (i >= nwords) {
+			break;
+		}
+		// Take as many bits as needed out of the word before storing it
+		uint64_t word = words[i];
+		do {
+			out[taken++] =
+				i * BITMAP_WORD_BITS + __builtin_ctzll(word);
+			word &= word - 1;
+		} while (word != 0 && taken < num);
+		words[i] = word;
+		if (word == 0) {
+			++i;
+		}
+	}
+	*start = i;
+	return taken;
+}
+
+void bitmap_fill(uint64_t *words, size_t nwords, size_t bits)
+{
+	size_t full = bits / BITMAP_WORD_BITS;
+	memset(words, 0xff, full * sizeof(*words));
+	if (full < nwords) {
+		size_t rest = bits % BITMAP_WORD_BITS;
+		words[full] = rest == 0 ? 0 : ~(uint64_t)0 >> (64 - rest);
+		memset(words + full + 1, 0,
+		       (nwords - full - 1) * sizeof(*words));
+	}
+}
+
+static size_t find_word_scalar(const uint64_t *words, size_t nwords,
+			       size_t start)
+{
+	for (size_t i = start; i < nwords; ++i) {
+		if (words[i] != 0) {
+			return i;
+		}
+	}
+	return nwords;
+}
+
+#if defined(__x86_64__)
+// Test four words at a time and leave the tail to the scalar loop
+__attribute__((target("avx2"))) static size_t
+find_word_avx2(const uint64_t *words, size_t nwords, size_t start)
+{
+	size_t i = start;
+	for (; i + 4 <= nwords; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+		if (!_mm256_testz_si256(v, v)) {
+			int mask = _mm256_movemask_pd(_mm256_castsi256_pd(
+				_mm256_cmpeq_epi64(v, _mm256_setzero_si256())));
+			return i + __builtin_ctz(~mask & 0xf);
+		}
+	}
+	return find_word_scalar(words, nwords, i);
+}
+
+// Eight words at a time, and the tail in one masked load
+__attribute__((target("avx512f"))) static size_t
+find_word_avx512(const uint64_t *words, size_t nwords, size_t start)
+{
+	size_t i = start;
+	for (; i + 8 <= nwords; i += 8) {
+		__m512i v = _mm512_loadu_si512(words + i);
+		__mmask8 mask = _mm512_test_epi64_mask(v, v);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	if (i < nwords) {
+		__mmask8 tail = (1u << (nwords - i)) - 1;
+		__m512i v = _mm512_maskz_loadu_epi64(tail, words + i);
+		__mmask8 mask = _mm512_test_epi64_mask(v, v);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return nwords;
+}
+
+#endif
+
+static size_t find_word_resolve(const uint64_t *words, size_t nwords,
+				size_t start)
+{
+	find_word_fn fn = find_word_scalar;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		fn = find_word_avx512;
+	} else if (__builtin_cpu_supports("avx2")) {
+		fn = find_word_avx2;
+	}
+#endif
+	__atomic_store_n(&find_word, fn, __ATOMIC_RELAXED);
+	return fn(words, nwords, start);
+}
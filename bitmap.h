@@ -0,0 +1,44 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bitmaps of free slots, one bit per slot with set meaning free, as used
+ * by slab pages. Finding the next free slot means finding the next
+ * nonzero word. On x86-64 that search uses AVX-512 or AVX2 when the CPU
+ * has them, picked on first use, and plain 64 bit words otherwise. The
+ * bit within a word is found with ctz.
+ */
+
+#define BITMAP_WORD_BITS 64
+
+// Words needed for bits slots
+#define BITMAP_WORDS(bits) (((bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+// Index of the first word at or after start with a bit set, or nwords if
+// there is none
+size_t bitmap_find_word(const uint64_t *words, size_t nwords, size_t start);
+
+/* Clear up to num set bits, lowest first, and write their indices to out.
+ * The search starts at word *start, which is moved to the first word that
+ * may still have bits set. Returns how many bits were taken, which is only
+ * less than num if the bitmap ran out.
+ */
+size_t bitmap_take(uint64_t *words, size_t nwords, size_t *start,
+		   uint32_t *out, size_t num);
+
+// Set the first bits bits and clear the rest of the nwords words
+void bitmap_fill(uint64_t *words, size_t nwords, size_t bits);
+
+static inline void bitmap_set(uint64_t *words, size_t idx)
+{
+	words[idx / BITMAP_WORD_BITS] |= (uint64_t)1 << (idx % BITMAP_WORD_BITS);
+}
+
+static inline int bitmap_test(const uint64_t *words, size_t idx)
+{
+	return (words[idx / BITMAP_WORD_BITS] >> (idx % BITMAP_WORD_BITS)) & 1;
+}
+
+#endif // _BITMAP_H
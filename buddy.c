@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "buddy.h"
+#include "kette.h"
+#include "page.h"
+
+#define BITS_PER_WORD 64
+
+static inline int is_pow2(size_t x);
+static inline size_t bit_index(struct buddy *buddy, unsigned int order,
+			       uintptr_t off);
+static inline int test_free(struct buddy *buddy, unsigned int order,
+			    uintptr_t off);
+static inline void push_free(struct buddy *buddy, unsigned int order,
+			     uintptr_t off);
+static inline void del_free(struct buddy *buddy, unsigned int order,
+			    uintptr_t off);
+
+int buddy_init(struct buddy *buddy, void *region, size_t bytes,
+	       size_t min_block)
+{
+	size_t ps = page_size();
+	if (!is_pow2(bytes) || !is_pow2(min_block) || min_block < ps ||
+	    bytes < min_block) {
+		errno = EINVAL;
+		return -1;
+	}
+	unsigned int min_shift = __builtin_ctzl(min_block);
+	unsigned int orders = __builtin_ctzl(bytes) - min_shift + 1;
+	if (orders > BUDDY_ORDER_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	// Bitmaps for every order need fewer than two bits per min block
+	size_t blocks = bytes >> min_shift;
+	size_t bit_words = (2 * blocks + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	size_t meta_bytes = bit_words * sizeof(uint64_t) + blocks;
+	void *meta = palloc((meta_bytes + ps - 1) / ps);
+	if (meta == NULL) {
+		return -1;
+	}
+	buddy->region = NULL;
+	if (region == NULL) {
+		region = palloc(bytes / ps);
+		if (region == NULL) {
+			pfree(meta);
+			return -1;
+		}
+		buddy->region = region;
+	}
+	buddy->base = (uintptr_t)region;
+	buddy->min_shift = min_shift;
+	buddy->orders = orders;
+	buddy->nonempty = 0;
+	for (unsigned int i = 0; i < BUDDY_ORDER_MAX; ++i) {
+		dlist_init(&buddy->free_heads[i]);
+	}
+	buddy->meta = meta;
+	buddy->free_bits = meta;
+	buddy->block_orders = (unsigned char *)meta +
+			      bit_words * sizeof(uint64_t);
+	memset(meta, 0, meta_bytes);
+	// The whole region starts out as one free block
+	push_free(buddy, orders - 1, 0);
+	return 0;
+}
+
+void *buddy_alloc(struct buddy *buddy, size_t bytes)
+{
+	// Check against the whole region first so the loop below never
+	// shifts past the top bit
+	if (bytes > (size_t)1 << (buddy->orders - 1 + buddy->min_shift)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	unsigned int order = 0;
+	while (((size_t)1 << (order + buddy->min_shift)) < bytes) {
+		++order;
+	}
+	// Smallest non empty order that fits
+	uint64_t fits = buddy->nonempty >> order;
+	if (fits == 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	unsigned int curr = order + __builtin_ctzl(fits);
+	struct dlink *node = buddy->free_heads[curr].next;
+	uintptr_t off = (uintptr_t)node - buddy->base;
+	del_free(buddy, curr, off);
+	// Split, handing the upper halves back to the free lists
+	while (curr > order) {
+		--curr;
+		push_free(buddy, curr,
+			  off + ((uintptr_t)1 << (curr + buddy->min_shift)));
+	}
+	buddy->block_orders[off >> buddy->min_shift] = order;
+	return (void *)(buddy->base + off);
+}
+
+void buddy_free(struct buddy *buddy, void *ptr)
+{
+	uintptr_t off = (uintptr_t)ptr - buddy->base;
+	unsigned int order = buddy->block_orders[off >> buddy->min_shift];
+	// Coalesce while the buddy is free too
+	while (order + 1 < buddy->orders) {
+		uintptr_t buddy_off =
+			off ^ ((uintptr_t)1 << (order + buddy->min_shift));
+		if (!test_free(buddy, order, buddy_off)) {
+			break;
+		}
+		del_free(buddy, order, buddy_off);
+		off &= buddy_off;
+		++order;
+	}
+	push_free(buddy, order, off);
+}
+
+void buddy_destroy(struct buddy *buddy)
+{
+	if (buddy->region != NULL) {
+		pfree(buddy->region);
+	}
+	pfree(buddy->meta);
+}
+
+static inline int is_pow2(size_t x)
+{
+	return x != 0 && (x & (x - 1)) == 0;
+}
+
+// Bitmaps are laid out from the smallest order up. Order k has half as
+// many blocks as order k - 1.
+static inline size_t bit_index(struct buddy *buddy, unsigned int order,
+			       uintptr_t off)
+{
+	size_t blocks = (size_t)1 << (buddy->orders - 1);
+	size_t start = 2 * blocks - (2 * blocks >> order);
+	return start + (off >> (order + buddy->min_shift));
+}
+
+static inline int test_free(struct buddy *buddy, unsigned int order,
+			    uintptr_t off)
+{
+	size_t bit = bit_index(buddy, order, off);
+	return (buddy->free_bits[bit / BITS_PER_WORD] >>
+		(bit % BITS_PER_WORD)) &
+	       1;
+}
+
+static inline void push_free(struct buddy *buddy, unsigned int order,
+			     uintptr_t off)
+{
+	size_t bit = bit_index(buddy, order, off);
+	buddy->free_bits[bit / BITS_PER_WORD] |= (uint64_t)1
+						 << (bit % BITS_PER_WORD);
+	dlist_add((struct dlink *)(buddy->base + off),
+		  &buddy->free_heads[order]);
+	buddy->nonempty |= (uint64_t)1 << order;
+}
+
+static inline void del_free(struct buddy *buddy, unsigned int order,
+			    uintptr_t off)
+{
+	size_t bit = bit_index(buddy, order, off);
+	buddy->free_bits[bit / BITS_PER_WORD] &=
+		~((uint64_t)1 << (bit % BITS_PER_WORD));
+	dlist_del((struct dlink *)(buddy->base + off));
+	if (list_empty(&buddy->free_heads[order])) {
+		buddy->nonempty &= ~((uint64_t)1 << order);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kette.h"
+
+/* A binary buddy allocator for power of two blocks. The region is split
+ * into blocks of min_block << order bytes. Each order has a free list and
+ * a bitmap of which blocks are free, so a block's buddy (its offset XOR
+ * its size) is checked in O(1) and coalescing never searches a list.
+ * Allocation and free are O(log n) at worst. Not thread safe.
+ */
+
+// Enough orders for any region on a 64 bit machine
+#define BUDDY_ORDER_MAX 48
+
+struct buddy {
+	uintptr_t base;
+	// log2 of the smallest block and number of orders
+	unsigned int min_shift;
+	unsigned int orders;
+	// Bit k is set when free_heads[k] is not empty
+	uint64_t nonempty;
+	struct dlink free_heads[BUDDY_ORDER_MAX];
+	// One bit per block per order, set while the block is free
+	uint64_t *free_bits;
+	// Order of every allocated block, indexed by its first min block
+	unsigned char *block_orders;
+	// Metadata (and the region if we mapped it) to give back to palloc
+	void *meta;
+	void *region;
+};
+
+// Manage bytes of memory at region, or palloc the region if it is NULL.
+// bytes and min_block must be powers of two and min_block must be at
+// least a page. Returns 0 on success or -1 with errno set.
+int buddy_init(struct buddy *buddy, void *region, size_t bytes,
+	       size_t min_block);
+
+// Allocate a block of at least bytes, rounded up to a power of two
+void *buddy_alloc(struct buddy *buddy, size_t bytes);
+
+// ptr MUST be a block returned by buddy_alloc
+void buddy_free(struct buddy *buddy, void *ptr);
+
+void buddy_destroy(struct buddy *buddy);
+
+#endif // _BUDDY_H
@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "compact.h"
+#include "handle.h"
+#include "kette.h"
+#include "page.h"
+#include "__utils.h"
+
+#define NO_SLOT UINT32_MAX
+#define SPAN_HEADER_SIZE \
+	((sizeof(struct compact_span) + COMPACT_ALIGN - 1) & \
+	 ~(size_t)(COMPACT_ALIGN - 1))
+
+static void *place(struct compact *c, uint32_t idx, size_t size);
+static struct compact_span *span_create(struct compact *c, size_t bytes);
+static void span_release(struct compact *c, struct compact_span *span);
+static struct compact_slot *slot_of(struct compact *c, handle_t handle);
+static int grow_slots(struct compact *c);
+static inline struct compact_span *span_of(void *ptr);
+static inline size_t obj_bytes(size_t size);
+
+void compact_init(struct compact *c)
+{
+	dlist_init(&c->spans_head);
+	c->current = NULL;
+	c->slots = NULL;
+	c->slots_len = 0;
+	c->slots_cap = 0;
+	c->free_slot = NO_SLOT;
+	c->live_bytes = 0;
+	c->span_bytes = 0;
+}
+
+handle_t compact_alloc(struct compact *c, size_t size)
+{
+	uint32_t idx = c->free_slot;
+	if (idx == NO_SLOT) {
+		if (unlikely(c->slots_len > HANDLE_INDEX_MASK)) {
+			errno = ENOMEM;
+			return HANDLE_NULL;
+		}
+		if (unlikely(c->slots_len == c->slots_cap) &&
+		    grow_slots(c) != 0) {
+			return HANDLE_NULL;
+		}
+		idx = c->slots_len++;
+		c->slots[idx].gen = 1;
+		c->slots[idx].ptr = NULL;
+		c->slots[idx].pins = NO_SLOT;
+		c->free_slot = idx;
+	}
+	struct compact_slot *slot = &c->slots[idx];
+	void *ptr = place(c, idx, size);
+	if (ptr == NULL) {
+		return HANDLE_NULL;
+	}
+	c->free_slot = slot->pins;
+	slot->ptr = ptr;
+	slot->pins = 0;
+	return (handle_t)slot->gen << HANDLE_INDEX_BITS | idx;
+}
+
+int compact_free(struct compact *c, handle_t handle)
+{
+	struct compact_slot *slot = slot_of(c, handle);
+	if (slot == NULL || slot->pins != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct compact_obj *obj = (struct compact_obj *)slot->ptr - 1;
+	struct compact_span *span = span_of(obj);
+	size_t bytes = obj_bytes(obj->size);
+	span->live_bytes -= bytes;
+	c->live_bytes -= bytes;
+	if (span->live_bytes == 0 && span != c->current) {
+		span_release(c, span);
+	}
+	slot->ptr = NULL;
+	slot->gen = (slot->gen + 1) & HANDLE_GEN_MASK;
+	if (slot->gen == 0) {
+		slot->gen = 1;
+	}
+	slot->pins = c->free_slot;
+	c->free_slot = handle_index(handle);
+	return 0;
+}
+
+void *compact_lock(struct compact *c, handle_t handle)
+{
+	struct compact_slot *slot = slot_of(c, handle);
+	if (slot == NULL) {
+		return NULL;
+	}
+	++slot->pins;
+	return slot->ptr;
+}
+
+void compact_unlock(struct compact *c, handle_t handle)
+{
+	struct compact_slot *slot = slot_of(c, handle);
+	_assert(slot != NULL && slot->pins > 0);
+	--slot->pins;
+}
+
+size_t compact_size(struct compact *c, handle_t handle)
+{
+	struct compact_slot *slot = slot_of(c, handle);
+	if (slot == NULL) {
+		return 0;
+	}
+	return ((struct compact_obj *)slot->ptr - 1)->size;
+}
+
+size_t compact_run(struct compact *c)
+{
+	size_t released = 0;
+	struct compact_span *span, *next;
+	// New spans are added at the head, so the walk never reaches the
+	// spans it is filling
+	for (span = list_entry(c->spans_head.next, struct compact_span,
+			       spans_head);
+	     &span->spans_head != &c->spans_head; span = next) {
+		next = list_entry(span->spans_head.next, struct compact_span,
+				  spans_head);
+		uintptr_t start = (uintptr_t)span + SPAN_HEADER_SIZE;
+		if (span == c->current ||
+		    span->live_bytes * 2 >= span->bump - start) {
+			continue;
+		}
+		for (uintptr_t pos = start; pos < span->bump;) {
+			struct compact_obj *obj = (struct compact_obj *)pos;
+			pos += obj_bytes(obj->size);
+			// Dead objects are the ones their slot no longer points
+			// to, whether it's free or has been given out again
+			struct compact_slot *slot = &c->slots[obj->slot];
+			if (slot->ptr != obj + 1 || slot->pins != 0) {
+				continue;
+			}
+			void *ptr = place(c, obj->slot, obj->size);
+			if (ptr == NULL) {
+				// Out of memory, what has moved so far stays moved
+				return released;
+			}
+			memcpy(ptr, obj + 1, obj->size);
+			slot->ptr = ptr;
+			span->live_bytes -= obj_bytes(obj->size);
+			c->live_bytes -= obj_bytes(obj->size);
+		}
+		// Only pinned objects keep a span alive
+		if (span->live_bytes == 0) {
+			released += span->end - (uintptr_t)span;
+			span_release(c, span);
+		}
+	}
+	return released;
+}
+
+void compact_destroy(struct compact *c)
+{
+	while (!list_empty(&c->spans_head)) {
+		span_release(c, list_entry(c->spans_head.next,
+					   struct compact_span, spans_head));
+	}
+	if (c->slots != NULL) {
+		pfree(c->slots);
+	}
+	compact_init(c);
+}
+
+// Bump size bytes for slot idx out of the current span, starting a new
+// span when it's full
+static void *place(struct compact *c, uint32_t idx, size_t size)
+{
+	size_t bytes = obj_bytes(size);
+	struct compact_span *span = c->current;
+	if (span == NULL || span->end - span->bump < bytes) {
+		span = span_create(c, bytes);
+		if (span == NULL) {
+			return NULL;
+		}
+		// An object too big for a normal span gets one of its own and
+		// the current span stays in use
+		if (c->current == NULL ||
+		    bytes <= COMPACT_SPAN_BYTES - SPAN_HEADER_SIZE) {
+			if (c->current != NULL && c->current->live_bytes == 0) {
+				span_release(c, c->current);
+			}
+			c->current = span;
+		}
+	}
+	struct compact_obj *obj = (struct compact_obj *)span->bump;
+	obj->slot = idx;
+	obj->size = size;
+	span->bump += bytes;
+	span->live_bytes += bytes;
+	c->live_bytes += bytes;
+	return obj + 1;
+}
+
+// Spans are aligned to COMPACT_SPAN_BYTES whatever their size, so the span
+// of an object is found by masking its address
+static struct compact_span *span_create(struct compact *c, size_t bytes)
+{
+	size_t ps = page_size();
+	size_t span_pnum = COMPACT_SPAN_BYTES / ps;
+	size_t pnum = (SPAN_HEADER_SIZE + bytes + ps - 1) / ps;
+	if (pnum < span_pnum) {
+		pnum = span_pnum;
+	}
+	struct compact_span *span = palloc_aligned(pnum, span_pnum);
+	if (span == NULL) {
+		return NULL;
+	}
+	span->bump = (uintptr_t)span + SPAN_HEADER_SIZE;
+	span->end = (uintptr_t)span + pnum * ps;
+	span->live_bytes = 0;
+	dlist_add(&span->spans_head, &c->spans_head);
+	c->span_bytes += pnum * ps;
+	return span;
+}
+
+static void span_release(struct compact *c, struct compact_span *span)
+{
+	if (span == c->current) {
+		c->current = NULL;
+	}
+	dlist_del(&span->spans_head);
+	c->span_bytes -= span->end - (uintptr_t)span;
+	pfree(span);
+}
+
+static struct compact_slot *slot_of(struct compact *c, handle_t handle)
+{
+	uint32_t idx = handle_index(handle);
+	if (idx >= c->slots_len || c->slots[idx].gen != handle_gen(handle) ||
+	    c->slots[idx].ptr == NULL) {
+		return NULL;
+	}
+	return &c->slots[idx];
+}
+
+static int grow_slots(struct compact *c)
+{
+	size_t ps = page_size();
+	size_t cap = c->slots_cap == 0 ? ps / sizeof(*c->slots) :
+					 c->slots_cap * 2;
+	size_t pnum = (cap * sizeof(*c->slots) + ps - 1) / ps;
+	struct compact_slot *slots = c->slots == NULL ?
+					     palloc(pnum) :
+					     prealloc(c->slots, pnum);
+	if (slots == NULL) {
+		return -1;
+	}
+	c->slots = slots;
+	c->slots_cap = cap;
+	return 0;
+}
+
+static inline struct compact_span *span_of(void *ptr)
+{
+	return (struct compact_span *)((uintptr_t)ptr &
+				       ~(uintptr_t)(COMPACT_SPAN_BYTES - 1));
+}
+
+static inline size_t obj_bytes(size_t size)
+{
+	return sizeof(struct compact_obj) +
+	       ((size + COMPACT_ALIGN - 1) & ~(size_t)(COMPACT_ALIGN - 1));
+}
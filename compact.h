@@ -0,0 +1,89 @@
+#ifndef _COMPACT_H
+#define _COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "handle.h"
+#include "kette.h"
+
+/* A moving allocator for long lived heaps of variable sized objects.
+ * Objects are bump allocated into spans from palloc and referred to by
+ * handles, so compact_run is free to move them. It copies the live
+ * objects out of spans that are mostly dead into fresh dense spans and
+ * frees the old spans, which puts a bound on fragmentation however long
+ * the heap lives.
+ *
+ * There are no stable pointers. compact_lock pins an object and returns
+ * its address, which stays valid until compact_unlock. Pinned objects are
+ * left where they are. Not thread safe.
+ */
+
+#define COMPACT_SPAN_BYTES (256 * 1024)
+#define COMPACT_ALIGN 16
+
+// Before every object in a span, so a span can be walked
+struct compact_obj {
+	uint32_t slot;
+	uint32_t pad;
+	uint64_t size;
+};
+
+// Header at the start of every span
+struct compact_span {
+	struct dlink spans_head;
+	// Next free byte and the end of the span
+	uintptr_t bump;
+	uintptr_t end;
+	// Bytes of live objects, headers included
+	size_t live_bytes;
+};
+
+// ptr is NULL while the slot is free and pins is then the next free slot
+struct compact_slot {
+	void *ptr;
+	uint32_t gen;
+	uint32_t pins;
+};
+
+struct compact {
+	struct dlink spans_head;
+	// Span new objects go into
+	struct compact_span *current;
+	struct compact_slot *slots;
+	size_t slots_len;
+	size_t slots_cap;
+	uint32_t free_slot;
+	// Bytes of live objects and bytes of spans, to decide when compacting
+	// is worth it
+	size_t live_bytes;
+	size_t span_bytes;
+};
+
+void compact_init(struct compact *c);
+
+// Allocate size bytes. Returns HANDLE_NULL if out of memory.
+handle_t compact_alloc(struct compact *c, size_t size);
+
+// Free the object of handle. Returns 0 on success or -1 if the handle is
+// stale or the object is pinned.
+int compact_free(struct compact *c, handle_t handle);
+
+// Pin the object of handle and return its address, or NULL if the handle
+// is stale. Pins nest.
+void *compact_lock(struct compact *c, handle_t handle);
+
+void compact_unlock(struct compact *c, handle_t handle);
+
+// Size the object of handle was allocated with, or 0 if it's stale
+size_t compact_size(struct compact *c, handle_t handle);
+
+// Move live objects out of spans where less than half of what was
+// allocated is still live and free those spans. Returns the bytes of
+// spans given back.
+size_t compact_run(struct compact *c);
+
+// Free every span and slot, including objects that are still allocated
+void compact_destroy(struct compact *c);
+
+#endif // _COMPACT_H
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "ebr.h"
+#include "kette.h"
+#include "pool.h"
+#include "__utils.h"
+
+// Low bit of ebr_thread.state
+#define EBR_ACTIVE 0x1
+// Retired objects a thread collects before it tries to advance the epoch
+#define EBR_BATCH 64
+
+static void limbo_add(struct ebr *ebr, struct slink **lists,
+		      uint64_t *epochs, uint64_t epoch, void *ptr);
+static void limbo_reclaim(struct ebr *ebr, struct slink **lists,
+			  uint64_t *epochs, uint64_t epoch);
+static void free_chain(struct ebr *ebr, struct slink *link);
+static uint64_t try_advance(struct ebr *ebr);
+
+int ebr_init(struct ebr *ebr, struct pool *pool, size_t link_offset)
+{
+	if (link_offset + sizeof(struct slink) > pool->obj_size) {
+		errno = EINVAL;
+		return -1;
+	}
+	ebr->epoch = 0;
+	ebr->pool = pool;
+	ebr->link_offset = link_offset;
+	pthread_mutex_init(&ebr->lock, NULL);
+	ebr->threads = NULL;
+	for (int i = 0; i < EBR_EPOCHS; ++i) {
+		ebr->orphans[i] = NULL;
+		ebr->orphan_epochs[i] = 0;
+	}
+	return 0;
+}
+
+void ebr_register(struct ebr *ebr, struct ebr_thread *t)
+{
+	t->state = 0;
+	t->ebr = ebr;
+	t->nesting = 0;
+	for (int i = 0; i < EBR_EPOCHS; ++i) {
+		t->limbo[i] = NULL;
+		t->limbo_epochs[i] = 0;
+	}
+	t->limbo_num = 0;
+	pthread_mutex_lock(&ebr->lock);
+	t->next = ebr->threads;
+	ebr->threads = t;
+	pthread_mutex_unlock(&ebr->lock);
+}
+
+void ebr_unregister(struct ebr_thread *t)
+{
+	struct ebr *ebr = t->ebr;
+	pthread_mutex_lock(&ebr->lock);
+	struct ebr_thread **prev = &ebr->threads;
+	while (*prev != t) {
+		prev = &(*prev)->next;
+	}
+	*prev = t->next;
+	uint64_t epoch = __atomic_load_n(&ebr->epoch, __ATOMIC_RELAXED);
+	for (int i = 0; i < EBR_EPOCHS; ++i) {
+		struct slink *link = t->limbo[i];
+		while (link != NULL) {
+			struct slink *next = link->next;
+			limbo_add(ebr, ebr->orphans, ebr->orphan_epochs,
+				  t->limbo_epochs[i],
+				  (char *)link - ebr->link_offset);
+			link = next;
+		}
+		t->limbo[i] = NULL;
+	}
+	limbo_reclaim(ebr, ebr->orphans, ebr->orphan_epochs, epoch);
+	pthread_mutex_unlock(&ebr->lock);
+}
+
+void ebr_enter(struct ebr_thread *t)
+{
+	if (t->nesting++ > 0) {
+		return;
+	}
+	struct ebr *ebr = t->ebr;
+	uint64_t epoch = __atomic_load_n(&ebr->epoch, __ATOMIC_RELAXED);
+	/* The announcement has to be visible before any shared pointer is
+	 * read, and it has to name the epoch that is current after that. If
+	 * the epoch moved while announcing, announce again, otherwise an
+	 * advancer that scanned before the store could move two epochs past
+	 * this thread.
+	 */
+	for (;;) {
+		__atomic_store_n(&t->state, epoch << 1 | EBR_ACTIVE,
+				 __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		uint64_t now = __atomic_load_n(&ebr->epoch, __ATOMIC_RELAXED);
+		if (likely(now == epoch)) {
+			break;
+		}
+		epoch = now;
+	}
+}
+
+void ebr_exit(struct ebr_thread *t)
+{
+	_assert(t->nesting > 0);
+	if (--t->nesting > 0) {
+		return;
+	}
+	__atomic_store_n(&t->state, t->state & ~(uint64_t)EBR_ACTIVE,
+			 __ATOMIC_RELEASE);
+}
+
+void ebr_retire(struct ebr_thread *t, void *ptr)
+{
+	struct ebr *ebr = t->ebr;
+	uint64_t epoch = __atomic_load_n(&ebr->epoch, __ATOMIC_ACQUIRE);
+	limbo_add(ebr, t->limbo, t->limbo_epochs, epoch, ptr);
+	if (unlikely(++t->limbo_num >= EBR_BATCH)) {
+		ebr_collect(t);
+	}
+}
+
+void ebr_collect(struct ebr_thread *t)
+{
+	struct ebr *ebr = t->ebr;
+	uint64_t epoch = try_advance(ebr);
+	limbo_reclaim(ebr, t->limbo, t->limbo_epochs, epoch);
+	t->limbo_num = 0;
+}
+
+void ebr_destroy(struct ebr *ebr)
+{
+	_assert(ebr->threads == NULL);
+	for (int i = 0; i < EBR_EPOCHS; ++i) {
+		free_chain(ebr, ebr->orphans[i]);
+		ebr->orphans[i] = NULL;
+	}
+	pthread_mutex_destroy(&ebr->lock);
+}
+
+// Put ptr on the list for epoch. The list it lands on may still hold
+// objects from three or more epochs ago, and those are safe to free now.
+// The same goes for ptr itself if the list is already three epochs ahead,
+// which happens when an unregistering thread hands over old objects.
+static void limbo_add(struct ebr *ebr, struct slink **lists,
+		      uint64_t *epochs, uint64_t epoch, void *ptr)
+{
+	unsigned int idx = epoch % EBR_EPOCHS;
+	if (unlikely(epochs[idx] > epoch)) {
+		pool_free(ebr->pool, ptr);
+		return;
+	}
+	if (epochs[idx] != epoch) {
+		free_chain(ebr, lists[idx]);
+		lists[idx] = NULL;
+		epochs[idx] = epoch;
+	}
+	struct slink *link = (struct slink *)((char *)ptr + ebr->link_offset);
+	link->next = lists[idx];
+	lists[idx] = link;
+}
+
+// Free the lists that are at least two epochs behind epoch
+static void limbo_reclaim(struct ebr *ebr, struct slink **lists,
+			  uint64_t *epochs, uint64_t epoch)
+{
+	for (int i = 0; i < EBR_EPOCHS; ++i) {
+		if (lists[i] != NULL && epochs[i] + 2 <= epoch) {
+			free_chain(ebr, lists[i]);
+			lists[i] = NULL;
+		}
+	}
+}
+
+static void free_chain(struct ebr *ebr, struct slink *link)
+{
+	while (link != NULL) {
+		struct slink *next = link->next;
+		pool_free(ebr->pool, (char *)link - ebr->link_offset);
+		link = next;
+	}
+}
+
+// Move the epoch on if every thread in a critical section has seen the
+// current one. Gives up straight away if someone else is already at it.
+// Returns the epoch after the attempt.
+static uint64_t try_advance(struct ebr *ebr)
+{
+	if (pthread_mutex_trylock(&ebr->lock) != 0) {
+		return __atomic_load_n(&ebr->epoch, __ATOMIC_ACQUIRE);
+	}
+	uint64_t epoch = ebr->epoch;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (struct ebr_thread *t = ebr->threads; t != NULL; t = t->next) {
+		// Acquire pairs with the release in ebr_exit, so whatever the
+		// thread read in its critical section is ordered before the
+		// objects are freed
+		uint64_t state = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+		if ((state & EBR_ACTIVE) && (state >> 1) != epoch) {
+			pthread_mutex_unlock(&ebr->lock);
+			return epoch;
+		}
+	}
+	__atomic_store_n(&ebr->epoch, ++epoch, __ATOMIC_RELEASE);
+	limbo_reclaim(ebr, ebr->orphans, ebr->orphan_epochs, epoch);
+	pthread_mutex_unlock(&ebr->lock);
+	return epoch;
+}
@@ -0,0 +1,88 @@
+#ifndef _EBR_H
+#define _EBR_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kette.h"
+#include "pool.h"
+
+/* Epoch based reclamation for objects from a pool that lock-free readers
+ * may still be looking at after they are unlinked.
+ *
+ * Readers wrap every access in ebr_enter/ebr_exit. A writer that unlinks
+ * an object hands it to ebr_retire, which puts it on the calling thread's
+ * limbo list for the current epoch. The global epoch only moves on once
+ * every thread inside a critical section has seen it, so anything retired
+ * two epochs back can no longer be reached and goes back to the pool in
+ * one batch.
+ *
+ * Retired objects are chained through a struct slink embedded in them at
+ * a fixed offset, so the rest of the object stays readable until it is
+ * freed. ebr_retire never blocks: advancing the epoch is only attempted
+ * with a trylock, and if another thread holds it that thread does the
+ * work.
+ */
+
+// Epochs an object can be in: the current one, the one before and those
+// old enough to free
+#define EBR_EPOCHS 3
+
+// One per thread that uses an ebr, usually in thread local storage
+struct ebr_thread {
+	// Epoch the thread entered with, shifted left by one, with the low
+	// bit set while it's inside a critical section
+	uint64_t state;
+	struct ebr_thread *next;
+	struct ebr *ebr;
+	unsigned int nesting;
+	// Retired objects waiting for every reader to move past them
+	struct slink *limbo[EBR_EPOCHS];
+	uint64_t limbo_epochs[EBR_EPOCHS];
+	// Retired since the last ebr_collect
+	size_t limbo_num;
+};
+
+struct ebr {
+	uint64_t epoch;
+	struct pool *pool;
+	// Offset of the struct slink used to chain retired objects
+	size_t link_offset;
+	// Protects the thread list and orphans and serializes epoch advances
+	pthread_mutex_t lock;
+	struct ebr_thread *threads;
+	// Objects left behind by threads that unregistered
+	struct slink *orphans[EBR_EPOCHS];
+	uint64_t orphan_epochs[EBR_EPOCHS];
+};
+
+// Reclaim objects from pool through the struct slink link_offset bytes
+// into each of them. Returns 0 on success or -1 with errno set.
+int ebr_init(struct ebr *ebr, struct pool *pool, size_t link_offset);
+
+// Add the calling thread. t must stay valid until ebr_unregister.
+void ebr_register(struct ebr *ebr, struct ebr_thread *t);
+
+// Remove the calling thread. Objects it retired that aren't safe to free
+// yet are handed over to the ebr. Must not be inside a critical section.
+void ebr_unregister(struct ebr_thread *t);
+
+// Start a critical section. Objects reachable from here on won't be
+// freed until the matching ebr_exit. Sections may nest.
+void ebr_enter(struct ebr_thread *t);
+
+void ebr_exit(struct ebr_thread *t);
+
+// Free ptr once no thread can still be reading it. ptr MUST already be
+// unreachable for readers that start after this call.
+void ebr_retire(struct ebr_thread *t, void *ptr);
+
+// Try to move the epoch on and free whatever the calling thread has that
+// became safe. ebr_retire does this on its own every so often.
+void ebr_collect(struct ebr_thread *t);
+
+// Free every retired object. No thread may be registered.
+void ebr_destroy(struct ebr *ebr);
+
+#endif // _EBR_H
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+
+#define ITERS 1000000
+#define ALLOCS 8
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Typical short function: a handful of small allocations then free
+static long use_arena(struct arena *a)
+{
+	long sum = 0;
+	for (int i = 0; i < ALLOCS; ++i) {
+		long *p = arena_alloc(a, 48);
+		*p = i;
+		sum += *p;
+	}
+	return sum;
+}
+
+int main()
+{
+	long sum = 0;
+	double start = now();
+	for (int i = 0; i < ITERS; ++i) {
+		struct arena *a = arena_create();
+		sum += use_arena(a);
+		arena_free(a);
+	}
+	double create_time = now() - start;
+
+	start = now();
+	for (int i = 0; i < ITERS; ++i) {
+		char buf[1024];
+		struct arena *a = arena_create_in(buf, sizeof(buf), 4096);
+		sum += use_arena(a);
+		arena_free(a);
+	}
+	double create_in_time = now() - start;
+
+	printf("arena_create:    %.1f ns per arena\n",
+	       create_time * 1e9 / ITERS);
+	printf("arena_create_in: %.1f ns per arena\n",
+	       create_in_time * 1e9 / ITERS);
+	return sum == 0;
+}
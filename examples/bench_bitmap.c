@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bitmap.h"
+
+// One slab of the smallest class
+#define BITS 16384
+#define WORDS BITMAP_WORDS(BITS)
+#define ITERS 200000
+#define BULK 32
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// What the search would be without vectors, as the baseline
+static size_t take_scalar(uint64_t *words, size_t nwords, uint32_t *out,
+			  size_t num)
+{
+	size_t taken = 0;
+	for (size_t i = 0; i < nwords && taken < num; ++i) {
+		while (words[i] != 0 && taken < num) {
+			out[taken++] = i * 64 + __builtin_ctzll(words[i]);
+			words[i] &= words[i] - 1;
+		}
+	}
+	return taken;
+}
+
+// Mark the first fill percent of the slots used, which is what a slab
+// looks like since slots are always taken lowest first
+static void fill(uint64_t *words, int percent)
+{
+	bitmap_fill(words, WORDS, BITS);
+	for (size_t i = 0; i < (size_t)BITS * percent / 100; ++i) {
+		words[i / 64] &= ~((uint64_t)1 << (i % 64));
+	}
+}
+
+// Take num slots from the start of the bitmap and put them back, so every
+// search walks over the used part again
+static double run(uint64_t *words, size_t num, int scalar)
+{
+	uint32_t idx[BULK];
+	double start = now();
+	for (int i = 0; i < ITERS; ++i) {
+		size_t hint = 0;
+		size_t got = scalar ? take_scalar(words, WORDS, idx, num) :
+				      bitmap_take(words, WORDS, &hint, idx, num);
+		for (size_t j = 0; j < got; ++j) {
+			bitmap_set(words, idx[j]);
+		}
+	}
+	return (now() - start) * 1e9 / ITERS;
+}
+
+int main()
+{
+	static uint64_t words[WORDS];
+	int levels[] = { 0, 50, 90, 99, 100 };
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	printf("search: %s\n", __builtin_cpu_supports("avx512f") ? "avx512" :
+			       __builtin_cpu_supports("avx2")	 ? "avx2" :
+								   "scalar");
+#else
+	printf("search: scalar\n");
+#endif
+	printf("fill    take 1 ns (scalar)    take %d ns (scalar)\n", BULK);
+	for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+		fill(words, levels[i]);
+		double one = run(words, 1, 0);
+		double one_scalar = run(words, 1, 1);
+		double bulk = run(words, BULK, 0);
+		double bulk_scalar = run(words, BULK, 1);
+		printf("%3d%%    %7.1f (%7.1f)      %7.1f (%7.1f)\n", levels[i],
+		       one, one_scalar, bulk, bulk_scalar);
+	}
+	return 0;
+}
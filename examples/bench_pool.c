@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pool.h"
+
+#define ITERS 20
+#define OBJS (1 << 20)
+#define OBJ_SIZE 64
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Free in a shuffled order so neither allocator gets LIFO for free
+static void shuffle(size_t *order, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		order[i] = i;
+	}
+	for (size_t i = n - 1; i > 0; --i) {
+		size_t j = rand() % (i + 1);
+		size_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+}
+
+int main()
+{
+	void **objs = malloc(OBJS * sizeof(*objs));
+	size_t *order = malloc(OBJS * sizeof(*order));
+	shuffle(order, OBJS);
+	long sum = 0;
+
+	struct pool pool;
+	pool_init(&pool, OBJ_SIZE);
+	double start = now();
+	for (int i = 0; i < ITERS; ++i) {
+		for (size_t j = 0; j < OBJS; ++j) {
+			objs[j] = pool_alloc(&pool);
+			*(long *)objs[j] = j;
+		}
+		for (size_t j = 0; j < OBJS; ++j) {
+			sum += *(long *)objs[order[j]];
+			pool_free(&pool, objs[order[j]]);
+		}
+	}
+	double pool_time = now() - start;
+	pool_destroy(&pool);
+
+	start = now();
+	for (int i = 0; i < ITERS; ++i) {
+		for (size_t j = 0; j < OBJS; ++j) {
+			objs[j] = malloc(OBJ_SIZE);
+			*(long *)objs[j] = j;
+		}
+		for (size_t j = 0; j < OBJS; ++j) {
+			sum += *(long *)objs[order[j]];
+			free(objs[order[j]]);
+		}
+	}
+	double malloc_time = now() - start;
+
+	double ops = 2.0 * ITERS * OBJS;
+	printf("pool:   %.2f ns per alloc/free\n", pool_time * 1e9 / ops);
+	printf("malloc: %.2f ns per alloc/free\n", malloc_time * 1e9 / ops);
+	free(objs);
+	free(order);
+	return sum == 0;
+}
@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "slab.h"
+
+#define THREADS 256
+#define CORES 2
+#define ITERS 200
+#define OBJS 256
+
+static void *(*alloc_fn)(size_t);
+static void (*free_fn)(void *);
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+	unsigned int seed = (uintptr_t)arg;
+	void *objs[OBJS];
+	long sum = 0;
+	for (int i = 0; i < ITERS; ++i) {
+		for (int j = 0; j < OBJS; ++j) {
+			objs[j] = alloc_fn(16 + rand_r(&seed) % 240);
+			*(long *)objs[j] = j;
+		}
+		for (int j = 0; j < OBJS; ++j) {
+			sum += *(long *)objs[j];
+			free_fn(objs[j]);
+		}
+	}
+	return (void *)sum;
+}
+
+static double run()
+{
+	pthread_t threads[THREADS];
+	double start = now();
+	for (uintptr_t i = 0; i < THREADS; ++i) {
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	}
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	return now() - start;
+}
+
+// Many more threads than cores is where per-thread caches waste the most
+int main()
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int i = 0; i < CORES; ++i) {
+		CPU_SET(i, &cpus);
+	}
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+
+	double ops = 2.0 * THREADS * ITERS * OBJS;
+	struct rusage usage;
+	// Run as separate phases so the RSS of each can be told apart
+	alloc_fn = salloc;
+	free_fn = sfree;
+	double slab_time = run();
+	getrusage(RUSAGE_SELF, &usage);
+	long slab_rss = usage.ru_maxrss;
+
+	alloc_fn = malloc;
+	free_fn = free;
+	double malloc_time = run();
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("%d threads on %d cores\n", THREADS, CORES);
+	printf("slab:   %.2f ns per alloc/free, max rss %ld KiB\n",
+	       slab_time * 1e9 / ops, slab_rss);
+	printf("malloc: %.2f ns per alloc/free, max rss %ld KiB\n",
+	       malloc_time * 1e9 / ops, usage.ru_maxrss);
+	return 0;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "page.h"
+#include "tlsf.h"
+
+#define OPS (1 << 21)
+#define SLOTS 4096
+#define REGION_BYTES (256 << 20)
+
+static struct tlsf tlsf;
+static long long lat[OPS];
+static void *slots[SLOTS];
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Mostly small messages with the odd big one
+static size_t next_size()
+{
+	if (rand() % 20 == 0) {
+		return 1024 + rand() % (64 * 1024);
+	}
+	return 16 + rand() % 1024;
+}
+
+static void report(const char *name)
+{
+	qsort(lat, OPS, sizeof(lat[0]), cmp);
+	printf("%-6s p50 %4lld ns  p99 %5lld ns  p99.99 %6lld ns  max %7lld ns\n",
+	       name, lat[OPS / 2], lat[(long)(OPS * 0.99)],
+	       lat[(long)(OPS * 0.9999)], lat[OPS - 1]);
+}
+
+// Each op frees a random slot if it is in use, otherwise fills it
+static void run(int use_tlsf)
+{
+	srand(42);
+	memset(slots, 0, sizeof(slots));
+	for (long i = 0; i < OPS; ++i) {
+		int slot = rand() % SLOTS;
+		size_t size = next_size();
+		long long start = now_ns();
+		if (slots[slot] != NULL) {
+			if (use_tlsf) {
+				tlsf_free(&tlsf, slots[slot]);
+			} else {
+				free(slots[slot]);
+			}
+			slots[slot] = NULL;
+		} else {
+			slots[slot] = use_tlsf ? tlsf_alloc(&tlsf, size) :
+						 malloc(size);
+		}
+		lat[i] = now_ns() - start;
+		if (slots[slot] != NULL) {
+			*(char *)slots[slot] = 1;
+		}
+	}
+	for (int i = 0; i < SLOTS; ++i) {
+		if (use_tlsf) {
+			tlsf_free(&tlsf, slots[i]);
+		} else {
+			free(slots[i]);
+		}
+	}
+}
+
+int main()
+{
+	// Touch the region up front so page faults don't show up as latency
+	void *region = palloc(REGION_BYTES / page_size());
+	memset(region, 0, REGION_BYTES);
+	if (tlsf_init(&tlsf, region, REGION_BYTES) != 0) {
+		perror("tlsf_init");
+		return 1;
+	}
+	run(1);
+	report("tlsf");
+	run(0);
+	report("malloc");
+	tlsf_destroy(&tlsf);
+	pfree(region);
+	return 0;
+}
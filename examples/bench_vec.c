@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arena.h"
+
+#define ITERS 20
+#define ELEMS (1 << 20)
+
+struct item {
+	long key;
+	long value;
+	long extra;
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Both vectors time their first round on memory that has never been
+ * touched. After that glibc hands the same heap back to realloc while
+ * every arena maps fresh pages, so the later rounds mostly measure page
+ * faults on one side only. They are reported apart.
+ */
+static long bench_arena_vec(double *times)
+{
+	long sum = 0;
+	for (int i = 0; i < ITERS; ++i) {
+		double start = now();
+		struct arena *a = arena_create();
+		struct arena_vec vec;
+		arena_vec_init(&vec, a, sizeof(struct item));
+		for (long j = 0; j < ELEMS; ++j) {
+			struct item *it = arena_vec_push(&vec);
+			it->key = j;
+			it->value = j * 2;
+		}
+		sum += ((struct item *)vec.data)[ELEMS - 1].value;
+		arena_free(a);
+		times[i] = now() - start;
+	}
+	return sum;
+}
+
+static long bench_realloc_vec(double *times)
+{
+	long sum = 0;
+	for (int i = 0; i < ITERS; ++i) {
+		double start = now();
+		struct item *data = NULL;
+		size_t len = 0, cap = 0;
+		for (long j = 0; j < ELEMS; ++j) {
+			if (len == cap) {
+				cap = cap == 0 ? 8 : cap * 2;
+				data = realloc(data, cap * sizeof(*data));
+			}
+			struct item *it = &data[len++];
+			it->key = j;
+			it->value = j * 2;
+		}
+		sum += data[ELEMS - 1].value;
+		free(data);
+		times[i] = now() - start;
+	}
+	return sum;
+}
+
+static void report(const char *name, double *times)
+{
+	double rest = 0;
+	for (int i = 1; i < ITERS; ++i) {
+		rest += times[i];
+	}
+	printf("%s first %.3f ms, then %.3f ms per %d pushes\n", name,
+	       times[0] * 1e3, rest * 1e3 / (ITERS - 1), ELEMS);
+}
+
+int main()
+{
+	double arena_times[ITERS];
+	double realloc_times[ITERS];
+	long sum = bench_arena_vec(arena_times);
+	sum += bench_realloc_vec(realloc_times);
+	report("arena_vec:", arena_times);
+	report("realloc:  ", realloc_times);
+	return sum == 0;
+}
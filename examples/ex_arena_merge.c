@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define OBJ "built in the child arena"
+
+// Build an object in a child arena, merge it into parent, then rewind
+// parent to a mark taken before the merge and keep allocating. The
+// object has to come out of that untouched.
+static int merge_then_rewind(struct arena *parent, int pages_before)
+{
+	for (int i = 0; i < pages_before; ++i) {
+		memset(arena_alloc(parent, 3000), 'P', 3000);
+	}
+	struct arena_mark mark = arena_mark(parent);
+	memset(arena_alloc(parent, 200), 'P', 200);
+
+	struct arena *child = arena_create_child(parent);
+	char *obj = arena_alloc(child, sizeof(OBJ));
+	memcpy(obj, OBJ, sizeof(OBJ));
+	char *big = arena_alloc(child, 8192);
+	memset(big, 'B', 8192);
+	arena_merge(parent, child);
+
+	arena_rewind(parent, mark);
+	for (int i = 0; i < 40; ++i) {
+		memset(arena_alloc(parent, 200), 'X', 200);
+	}
+	memset(arena_alloc(parent, 8192), 'X', 8192);
+
+	int ok = memcmp(obj, OBJ, sizeof(OBJ)) == 0 && big[0] == 'B' &&
+		 big[8191] == 'B';
+	printf("%d pages before the mark: %.*s -> %s\n", pages_before,
+	       (int)sizeof(OBJ) - 1, obj, ok ? "ok" : "overwritten");
+	return ok;
+}
+
+int main()
+{
+	int ok = 1;
+	for (int pages = 0; pages < 3; ++pages) {
+		struct arena *parent = arena_create();
+		ok &= merge_then_rewind(parent, pages);
+		arena_free(parent);
+	}
+	return !ok;
+}
@@ -0,0 +1,65 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+#define THREADS 16
+#define OBJS 256
+#define ROUNDS 100
+
+// Objects each thread hands over to the next, so frees cross threads
+static void *handoff[THREADS][OBJS];
+static long bad;
+
+// Fill every object with its owner and index, check it, then free half
+// and hand the other half to the next thread. Meant to be built with
+// -fsanitize=address or -fsanitize=thread.
+static void *worker(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	unsigned int seed = id;
+	void *objs[OBJS];
+	for (int r = 0; r < ROUNDS; ++r) {
+		for (int i = 0; i < OBJS; ++i) {
+			size_t size = 8 + rand_r(&seed) % 2048;
+			uintptr_t *obj = salloc(size);
+			for (size_t j = 0; j < size / sizeof(*obj); ++j) {
+				obj[j] = id << 32 | i;
+			}
+			objs[i] = obj;
+		}
+		for (int i = 0; i < OBJS; ++i) {
+			if (*(uintptr_t *)objs[i] != (id << 32 | i)) {
+				__atomic_fetch_add(&bad, 1, __ATOMIC_RELAXED);
+			}
+			if (i & 1) {
+				sfree(__atomic_exchange_n(
+					&handoff[(id + 1) % THREADS][i],
+					objs[i], __ATOMIC_ACQ_REL));
+			} else {
+				sfree(objs[i]);
+			}
+		}
+	}
+	return NULL;
+}
+
+int main()
+{
+	pthread_t threads[THREADS];
+	for (uintptr_t i = 0; i < THREADS; ++i) {
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	}
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	for (int i = 0; i < THREADS; ++i) {
+		for (int j = 0; j < OBJS; ++j) {
+			sfree(handoff[i][j]);
+		}
+	}
+	printf("%ld objects handed out twice\n", bad);
+	return bad != 0;
+}
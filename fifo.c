@@ -0,0 +1,135 @@
+#include <errno.h>
+#include <stdint.h>
+
+#include "fifo.h"
+#include "kette.h"
+#include "page.h"
+#include "__utils.h"
+
+#define FIFO_ALIGN 16
+#define CHUNK_HEADER_SIZE \
+	((sizeof(struct fifo_chunk) + FIFO_ALIGN - 1) & ~(FIFO_ALIGN - 1))
+
+static struct fifo_chunk *chunk_create(struct fifo *fifo, size_t bytes);
+static void chunk_reset(struct fifo_chunk *chunk, uint64_t pos);
+static void chunk_release(struct fifo *fifo, struct fifo_chunk *chunk);
+static inline struct fifo_chunk *head_chunk(struct fifo *fifo);
+
+int fifo_init(struct fifo *fifo, size_t chunk_bytes)
+{
+	int ps = page_size();
+	fifo->chunk_pages = (chunk_bytes + CHUNK_HEADER_SIZE + ps - 1) / ps;
+	dlist_init(&fifo->chunks_head);
+	fifo->spare = NULL;
+	fifo->head = 0;
+	struct fifo_chunk *chunk = chunk_create(fifo, 0);
+	if (chunk == NULL) {
+		return -1;
+	}
+	dlist_add_tail(&chunk->chunks_head, &fifo->chunks_head);
+	return 0;
+}
+
+void *fifo_alloc(struct fifo *fifo, size_t bytes)
+{
+	bytes = (bytes + FIFO_ALIGN - 1) & ~(size_t)(FIFO_ALIGN - 1);
+	struct fifo_chunk *chunk = head_chunk(fifo);
+	if (unlikely(chunk->end - chunk->idx < bytes)) {
+		// The rest of the head chunk is skipped, so the new chunk
+		// starts at the logical end of the old one
+		fifo->head += chunk->end - chunk->idx;
+		chunk = chunk_create(fifo, bytes);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk_reset(chunk, fifo->head);
+		dlist_add_tail(&chunk->chunks_head, &fifo->chunks_head);
+	}
+	void *ptr = (void *)chunk->idx;
+	chunk->idx += bytes;
+	fifo->head += bytes;
+	return ptr;
+}
+
+void fifo_release(struct fifo *fifo, uint64_t mark)
+{
+	struct fifo_chunk *head = head_chunk(fifo);
+	for (;;) {
+		struct fifo_chunk *tail = list_entry(
+			fifo->chunks_head.next, struct fifo_chunk, chunks_head);
+		if (tail == head) {
+			break;
+		}
+		// A chunk ends where the one after it starts
+		struct fifo_chunk *next = list_entry(
+			tail->chunks_head.next, struct fifo_chunk, chunks_head);
+		if (next->pos > mark) {
+			return;
+		}
+		dlist_del(&tail->chunks_head);
+		chunk_release(fifo, tail);
+	}
+	// Nothing is live, so start the head chunk over
+	if (mark >= fifo->head) {
+		chunk_reset(head, fifo->head);
+	}
+}
+
+void fifo_destroy(struct fifo *fifo)
+{
+	struct dlink *next;
+	for (struct dlink *d = fifo->chunks_head.next; d != &fifo->chunks_head;
+	     d = next) {
+		next = d->next;
+		pfree(list_entry(d, struct fifo_chunk, chunks_head));
+	}
+	dlist_init(&fifo->chunks_head);
+	if (fifo->spare != NULL) {
+		pfree(fifo->spare);
+		fifo->spare = NULL;
+	}
+}
+
+// Reuse the spare chunk unless bytes needs an oversized one
+static struct fifo_chunk *chunk_create(struct fifo *fifo, size_t bytes)
+{
+	int ps = page_size();
+	size_t num_pages = (bytes + CHUNK_HEADER_SIZE + ps - 1) / ps;
+	if (num_pages <= fifo->chunk_pages) {
+		num_pages = fifo->chunk_pages;
+		if (fifo->spare != NULL) {
+			struct fifo_chunk *chunk = fifo->spare;
+			fifo->spare = NULL;
+			return chunk;
+		}
+	}
+	struct fifo_chunk *chunk = palloc(num_pages);
+	if (chunk == NULL) {
+		return NULL;
+	}
+	chunk->end = (uintptr_t)chunk + num_pages * ps;
+	chunk_reset(chunk, fifo->head);
+	return chunk;
+}
+
+static void chunk_reset(struct fifo_chunk *chunk, uint64_t pos)
+{
+	chunk->pos = pos;
+	chunk->idx = (uintptr_t)chunk + CHUNK_HEADER_SIZE;
+}
+
+static void chunk_release(struct fifo *fifo, struct fifo_chunk *chunk)
+{
+	size_t bytes = chunk->end - (uintptr_t)chunk;
+	if (fifo->spare == NULL && bytes == fifo->chunk_pages * page_size()) {
+		fifo->spare = chunk;
+		return;
+	}
+	pfree(chunk);
+}
+
+static inline struct fifo_chunk *head_chunk(struct fifo *fifo)
+{
+	return list_entry(fifo->chunks_head.prev, struct fifo_chunk,
+			  chunks_head);
+}
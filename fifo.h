@@ -0,0 +1,52 @@
+#ifndef _FIFO_H
+#define _FIFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kette.h"
+
+/* A log structured allocator for data that is freed in the order it was
+ * allocated, such as a sliding window of recent events. Allocations are
+ * bumped at the head of a queue of chunks from palloc. Every allocation
+ * has a logical position that only increases, and fifo_release frees
+ * everything before a position, handing whole chunks back as the tail
+ * passes them. One released chunk is kept for reuse so a steady window
+ * cycles through the same memory. Not thread safe.
+ */
+
+struct fifo_chunk {
+	struct dlink chunks_head;
+	// Logical position of the first byte in the chunk
+	uint64_t pos;
+	uintptr_t idx;
+	uintptr_t end;
+};
+
+struct fifo {
+	// Oldest chunk first, the head chunk is last
+	struct dlink chunks_head;
+	struct fifo_chunk *spare;
+	size_t chunk_pages;
+	// Logical position of the next allocation
+	uint64_t head;
+};
+
+// Returns 0 on success or -1 with errno set
+int fifo_init(struct fifo *fifo, size_t chunk_bytes);
+
+void *fifo_alloc(struct fifo *fifo, size_t bytes);
+
+// Position of the next allocation. Everything allocated so far is before
+// it.
+static inline uint64_t fifo_mark(struct fifo *fifo)
+{
+	return fifo->head;
+}
+
+// Free everything allocated before mark
+void fifo_release(struct fifo *fifo, uint64_t mark);
+
+void fifo_destroy(struct fifo *fifo);
+
+#endif // _FIFO_H
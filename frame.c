@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "page.h"
+#include "__utils.h"
+
+#define CHUNK_HEADER_SIZE \
+	((sizeof(struct frame_chunk) + FRAME_ALIGN - 1) & ~(FRAME_ALIGN - 1))
+
+static struct frame_chunk *chunk_create(struct frame *frame, size_t bytes);
+static inline uintptr_t chunk_start(struct frame_chunk *chunk);
+
+int frame_init(struct frame *frame, unsigned int num, size_t chunk_bytes)
+{
+	if (num == 0 || num > FRAME_NUM_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	int ps = page_size();
+	frame->chunk_pages = (chunk_bytes + CHUNK_HEADER_SIZE + ps - 1) / ps;
+	frame->num = num;
+	frame->cur = 0;
+	for (unsigned int i = 0; i < num; ++i) {
+		struct frame_chunk *chunk = chunk_create(frame, 0);
+		if (chunk == NULL) {
+			frame->num = i;
+			frame_destroy(frame);
+			return -1;
+		}
+		struct frame_arena *arena = &frame->arenas[i];
+		arena->first = arena->current = chunk;
+		arena->idx = chunk_start(chunk);
+	}
+	return 0;
+}
+
+void *frame_grow(struct frame *frame, size_t bytes)
+{
+	struct frame_arena *arena = &frame->arenas[frame->cur];
+	struct frame_chunk *chunk = arena->current->next;
+	// Chunks kept from earlier frames too small for this are skipped and
+	// only come back into use after the next reset
+	while (chunk != NULL && chunk->end - chunk_start(chunk) < bytes) {
+		chunk = chunk->next;
+	}
+	if (chunk == NULL) {
+		chunk = chunk_create(frame, bytes);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->next = arena->current->next;
+		arena->current->next = chunk;
+	}
+	arena->current = chunk;
+	arena->idx = chunk_start(chunk) + bytes;
+	return (void *)chunk_start(chunk);
+}
+
+void frame_advance(struct frame *frame)
+{
+	if (++frame->cur == frame->num) {
+		frame->cur = 0;
+	}
+	struct frame_arena *arena = &frame->arenas[frame->cur];
+	arena->current = arena->first;
+	arena->idx = chunk_start(arena->first);
+}
+
+void frame_destroy(struct frame *frame)
+{
+	for (unsigned int i = 0; i < frame->num; ++i) {
+		struct frame_chunk *next;
+		for (struct frame_chunk *chunk = frame->arenas[i].first;
+		     chunk != NULL; chunk = next) {
+			next = chunk->next;
+			pfree(chunk);
+		}
+		frame->arenas[i].first = frame->arenas[i].current = NULL;
+	}
+	frame->num = 0;
+}
+
+// A chunk of the usual size, or bigger if bytes wouldn't fit in one
+static struct frame_chunk *chunk_create(struct frame *frame, size_t bytes)
+{
+	int ps = page_size();
+	size_t pnum = (bytes + CHUNK_HEADER_SIZE + ps - 1) / ps;
+	if (pnum < frame->chunk_pages) {
+		pnum = frame->chunk_pages;
+	}
+	struct frame_chunk *chunk = palloc(pnum);
+	if (chunk == NULL) {
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->end = (uintptr_t)chunk + pnum * ps;
+	return chunk;
+}
+
+static inline uintptr_t chunk_start(struct frame_chunk *chunk)
+{
+	return (uintptr_t)chunk + CHUNK_HEADER_SIZE;
+}
@@ -0,0 +1,64 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* An allocator for per frame data in a loop, such as a server tick.
+ * There are num rotating frames, each a chain of chunks from palloc that
+ * allocations are bumped through. frame_advance moves on to the oldest
+ * frame and resets it in O(1) by pointing it back at its first chunk.
+ * Its chunks are kept, so once the loop has warmed up it makes no
+ * syscalls at all. Data allocated in a frame stays valid for the next
+ * num - 1 frames, so with num = 2 it survives exactly one extra frame.
+ * Not thread safe.
+ */
+
+#define FRAME_NUM_MAX 8
+#define FRAME_ALIGN 16
+
+struct frame_chunk {
+	struct frame_chunk *next;
+	uintptr_t end;
+};
+
+struct frame_arena {
+	struct frame_chunk *first;
+	// Chunk being bumped through. Those after it are free for reuse.
+	struct frame_chunk *current;
+	uintptr_t idx;
+};
+
+struct frame {
+	struct frame_arena arenas[FRAME_NUM_MAX];
+	unsigned int num;
+	// Frame allocations go into
+	unsigned int cur;
+	size_t chunk_pages;
+};
+
+// Set up num frames that grow by chunk_bytes at a time. Returns 0 on
+// success or -1 with errno set.
+int frame_init(struct frame *frame, unsigned int num, size_t chunk_bytes);
+
+// Move to the next chunk of the current frame. Used by frame_alloc.
+void *frame_grow(struct frame *frame, size_t bytes);
+
+static inline void *frame_alloc(struct frame *frame, size_t bytes)
+{
+	struct frame_arena *arena = &frame->arenas[frame->cur];
+	bytes = (bytes + FRAME_ALIGN - 1) & ~(size_t)(FRAME_ALIGN - 1);
+	if (arena->current->end - arena->idx < bytes) {
+		return frame_grow(frame, bytes);
+	}
+	void *ptr = (void *)arena->idx;
+	arena->idx += bytes;
+	return ptr;
+}
+
+// Start the next frame, freeing everything allocated in the oldest one
+void frame_advance(struct frame *frame);
+
+void frame_destroy(struct frame *frame);
+
+#endif // _FRAME_H
@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "handle.h"
+#include "page.h"
+#include "__utils.h"
+
+#define NO_SLOT UINT32_MAX
+
+static int grow_objects(struct handle_pool *pool);
+static int grow_slots(struct handle_pool *pool);
+static void *grow_array(void *array, size_t old_bytes, size_t bytes);
+
+int handle_pool_init(struct handle_pool *pool, size_t obj_size)
+{
+	if (obj_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	pool->obj_size = obj_size;
+	pool->len = 0;
+	pool->cap = 0;
+	pool->data = NULL;
+	pool->owners = NULL;
+	pool->slots = NULL;
+	pool->slots_len = 0;
+	pool->slots_cap = 0;
+	pool->free_slot = NO_SLOT;
+	return 0;
+}
+
+handle_t handle_alloc(struct handle_pool *pool, void **obj)
+{
+	if (unlikely(pool->len == pool->cap) && grow_objects(pool) != 0) {
+		return HANDLE_NULL;
+	}
+	uint32_t idx = pool->free_slot;
+	if (idx != NO_SLOT) {
+		pool->free_slot = pool->slots[idx].pos;
+	} else {
+		if (unlikely(pool->slots_len > HANDLE_INDEX_MASK)) {
+			errno = ENOMEM;
+			return HANDLE_NULL;
+		}
+		if (unlikely(pool->slots_len == pool->slots_cap) &&
+		    grow_slots(pool) != 0) {
+			return HANDLE_NULL;
+		}
+		idx = pool->slots_len++;
+		pool->slots[idx].gen = 1;
+	}
+	size_t pos = pool->len++;
+	pool->slots[idx].pos = pos;
+	pool->owners[pos] = idx;
+	if (obj != NULL) {
+		*obj = (char *)pool->data + pos * pool->obj_size;
+	}
+	return (handle_t)pool->slots[idx].gen << HANDLE_INDEX_BITS | idx;
+}
+
+int handle_free(struct handle_pool *pool, handle_t handle)
+{
+	uint32_t idx = handle_index(handle);
+	if (idx >= pool->slots_len ||
+	    pool->slots[idx].gen != handle_gen(handle)) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct handle_slot *slot = &pool->slots[idx];
+	// Move the last object into the hole to keep the array packed
+	size_t pos = slot->pos;
+	size_t last = --pool->len;
+	if (pos != last) {
+		memcpy((char *)pool->data + pos * pool->obj_size,
+		       (char *)pool->data + last * pool->obj_size,
+		       pool->obj_size);
+		uint32_t moved = pool->owners[last];
+		pool->owners[pos] = moved;
+		pool->slots[moved].pos = pos;
+	}
+	// Generation 0 is never handed out so HANDLE_NULL stays invalid
+	slot->gen = (slot->gen + 1) & HANDLE_GEN_MASK;
+	if (slot->gen == 0) {
+		slot->gen = 1;
+	}
+	slot->pos = pool->free_slot;
+	pool->free_slot = idx;
+	return 0;
+}
+
+void handle_pool_destroy(struct handle_pool *pool)
+{
+	if (pool->data != NULL) {
+		pfree(pool->data);
+		pfree(pool->owners);
+	}
+	if (pool->slots != NULL) {
+		pfree(pool->slots);
+	}
+	pool->data = NULL;
+	pool->owners = NULL;
+	pool->slots = NULL;
+	pool->len = pool->cap = 0;
+	pool->slots_len = pool->slots_cap = 0;
+	pool->free_slot = NO_SLOT;
+}
+
+// Double the object array and the owners array alongside it
+static int grow_objects(struct handle_pool *pool)
+{
+	size_t cap = pool->cap == 0 ? page_size() / sizeof(uint32_t) :
+				      pool->cap * 2;
+	void *data = grow_array(pool->data, pool->cap * pool->obj_size,
+				cap * pool->obj_size);
+	if (data == NULL) {
+		return -1;
+	}
+	pool->data = data;
+	uint32_t *owners = grow_array(pool->owners,
+				      pool->cap * sizeof(*owners),
+				      cap * sizeof(*owners));
+	if (owners == NULL) {
+		// Keep the bigger data array, cap just doesn't move
+		return -1;
+	}
+	pool->owners = owners;
+	pool->cap = cap;
+	return 0;
+}
+
+static int grow_slots(struct handle_pool *pool)
+{
+	size_t cap = pool->slots_cap == 0 ?
+			     page_size() / sizeof(struct handle_slot) :
+			     pool->slots_cap * 2;
+	struct handle_slot *slots =
+		grow_array(pool->slots, pool->slots_cap * sizeof(*slots),
+			   cap * sizeof(*slots));
+	if (slots == NULL) {
+		return -1;
+	}
+	pool->slots = slots;
+	pool->slots_cap = cap;
+	return 0;
+}
+
+// Grow to bytes with prealloc, which moves page table entries instead of
+// copying the objects
+static void *grow_array(void *array, size_t old_bytes, size_t bytes)
+{
+	size_t ps = page_size();
+	size_t pnum = (bytes + ps - 1) / ps;
+	if (array != NULL && (old_bytes + ps - 1) / ps == pnum) {
+		return array;
+	}
+	return array == NULL ? palloc(pnum) : prealloc(array, pnum);
+}
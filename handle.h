@@ -0,0 +1,116 @@
+#ifndef _HANDLE_H
+#define _HANDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A pool of fixed size objects referred to by handles instead of
+ * pointers. A handle is a slot index and the generation of the slot when
+ * the handle was made, and every free bumps the generation, so a stale
+ * handle is caught with one compare instead of pointing at whatever took
+ * its place.
+ *
+ * Objects live packed at the front of one array. Freeing moves the last
+ * object into the hole, so iterating over all of them is a plain linear
+ * scan of handle_pool_data. Slots map handles to positions in the array
+ * and the owners array maps positions back to slots. All three grow with
+ * prealloc, so growing never copies. Not thread safe.
+ *
+ * Handles are 64 bits, 32 for the index and 32 for the generation. Build
+ * with HANDLE_32BIT for 32 bit handles with 20 and 12.
+ */
+
+#ifdef HANDLE_32BIT
+typedef uint32_t handle_t;
+#define HANDLE_INDEX_BITS 20
+#else
+typedef uint64_t handle_t;
+#define HANDLE_INDEX_BITS 32
+#endif
+
+#define HANDLE_GEN_BITS (sizeof(handle_t) * 8 - HANDLE_INDEX_BITS)
+#define HANDLE_INDEX_MASK (((handle_t)1 << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK ((handle_t)-1 >> HANDLE_INDEX_BITS)
+// Generations start at 1 so this is never a live handle
+#define HANDLE_NULL ((handle_t)0)
+
+// gen is the generation of the slot while it's in use. While it's free
+// next is the next free slot, otherwise it's the object's position.
+struct handle_slot {
+	uint32_t gen;
+	uint32_t pos;
+};
+
+struct handle_pool {
+	size_t obj_size;
+	// Objects in use, packed at the front of data
+	size_t len;
+	size_t cap;
+	void *data;
+	// Slot of the object at each position
+	uint32_t *owners;
+	struct handle_slot *slots;
+	size_t slots_len;
+	size_t slots_cap;
+	// First free slot, or UINT32_MAX
+	uint32_t free_slot;
+};
+
+// Returns 0 on success or -1 with errno set
+int handle_pool_init(struct handle_pool *pool, size_t obj_size);
+
+/* Allocate an object and return its handle, or HANDLE_NULL if out of
+ * memory. If obj isn't NULL it gets a pointer to the object, which stays
+ * valid until the next handle_alloc or handle_free.
+ */
+handle_t handle_alloc(struct handle_pool *pool, void **obj);
+
+// Free the object of handle. Returns 0 on success or -1 if the handle is
+// stale.
+int handle_free(struct handle_pool *pool, handle_t handle);
+
+void handle_pool_destroy(struct handle_pool *pool);
+
+static inline uint32_t handle_index(handle_t handle)
+{
+	return handle & HANDLE_INDEX_MASK;
+}
+
+static inline uint32_t handle_gen(handle_t handle)
+{
+	return handle >> HANDLE_INDEX_BITS;
+}
+
+// The object of handle, or NULL if the handle is stale. The pointer stays
+// valid until the next handle_alloc or handle_free.
+static inline void *handle_get(struct handle_pool *pool, handle_t handle)
+{
+	uint32_t idx = handle_index(handle);
+	if (idx >= pool->slots_len ||
+	    pool->slots[idx].gen != handle_gen(handle)) {
+		return NULL;
+	}
+	return (char *)pool->data +
+	       (size_t)pool->slots[idx].pos * pool->obj_size;
+}
+
+// Objects in use, packed from position 0 to handle_pool_len. The pointer
+// stays valid until the next handle_alloc.
+static inline void *handle_pool_data(struct handle_pool *pool)
+{
+	return pool->data;
+}
+
+static inline size_t handle_pool_len(struct handle_pool *pool)
+{
+	return pool->len;
+}
+
+// The handle of the object at position pos, for use while iterating
+static inline handle_t handle_at(struct handle_pool *pool, size_t pos)
+{
+	uint32_t idx = pool->owners[pos];
+	return (handle_t)pool->slots[idx].gen << HANDLE_INDEX_BITS | idx;
+}
+
+#endif // _HANDLE_H
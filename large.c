@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "large.h"
+#include "page.h"
+#include "__utils.h"
+
+#define LARGE_MAGIC 0x1A26E0B7EC7ULL
+#define THP_ENABLED "/sys/kernel/mm/transparent_hugepage/enabled"
+#define THP_SIZE "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size"
+
+// Fills the page before the data
+struct large_header {
+	uint64_t magic;
+	// Pages in the mapping, header included
+	size_t pnum;
+	// Pages the data is aligned to
+	size_t align_pnum;
+};
+
+// Pages in a huge page, or 0 if huge pages aren't worth asking for
+static size_t huge_pnum;
+static pthread_once_t large_once = PTHREAD_ONCE_INIT;
+
+static void large_init();
+static size_t align_for(size_t data_pnum);
+static struct large_header *map_object(size_t pnum, size_t align_pnum);
+static inline struct large_header *header_of(void *ptr);
+static inline void *data_of(struct large_header *header);
+
+void *lalloc(size_t size)
+{
+	pthread_once(&large_once, large_init);
+	if (size == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	size_t ps = page_size();
+	// Rounding up with the header page would wrap
+	if (size > SIZE_MAX - 2 * ps) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size_t data_pnum = (size + ps - 1) / ps;
+	size_t align_pnum = align_for(data_pnum);
+	struct large_header *header = map_object(data_pnum + 1, align_pnum);
+	if (header == NULL) {
+		return NULL;
+	}
+	header->magic = LARGE_MAGIC;
+	header->pnum = data_pnum + 1;
+	header->align_pnum = align_pnum;
+	// Advise the header page too. Giving it other flags would split the
+	// mapping in two and mremap can't work across that.
+	if (align_pnum > 1) {
+		madvise(header, header->pnum * ps, MADV_HUGEPAGE);
+	}
+	return data_of(header);
+}
+
+void lfree(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	struct large_header *header = header_of(ptr);
+	_assert(header->magic == LARGE_MAGIC);
+	prelease(header, header->pnum);
+}
+
+void *lrealloc(void *ptr, size_t size)
+{
+	if (ptr == NULL) {
+		return lalloc(size);
+	}
+	if (size == 0) {
+		lfree(ptr);
+		return NULL;
+	}
+	struct large_header *header = header_of(ptr);
+	_assert(header->magic == LARGE_MAGIC);
+	size_t ps = page_size();
+	if (size > SIZE_MAX - 2 * ps) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size_t pnum = (size + ps - 1) / ps + 1;
+	if (pnum == header->pnum) {
+		return ptr;
+	}
+	size_t old_len = header->pnum * ps;
+	size_t new_len = pnum * ps;
+	// Shrinking, or growing into free address space, keeps the address
+	void *addr = mremap(header, old_len, new_len, 0);
+	if (addr == MAP_FAILED) {
+		if (header->align_pnum == 1) {
+			addr = mremap(header, old_len, new_len, MREMAP_MAYMOVE);
+		} else {
+			// Move onto a reservation that keeps the data aligned.
+			// MREMAP_FIXED replaces it in one go.
+			struct large_header *dest =
+				map_object(pnum, header->align_pnum);
+			if (dest == NULL) {
+				return NULL;
+			}
+			addr = mremap(header, old_len, new_len,
+				      MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+			if (addr == MAP_FAILED) {
+				prelease(dest, pnum);
+			}
+		}
+		if (addr == MAP_FAILED) {
+			return NULL;
+		}
+	}
+	header = addr;
+	header->pnum = pnum;
+	return data_of(header);
+}
+
+size_t lusable_size(void *ptr)
+{
+	struct large_header *header = header_of(ptr);
+	return (header->pnum - 1) * page_size();
+}
+
+static void large_init()
+{
+	char buf[64];
+	int fd = open(THP_ENABLED, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return;
+	}
+	buf[len] = '\0';
+	if (strstr(buf, "[never]") != NULL) {
+		return;
+	}
+	fd = open(THP_SIZE, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return;
+	}
+	buf[len] = '\0';
+	size_t pnum = strtoul(buf, NULL, 10) / page_size();
+	// Only a power of two is of any use for alignment
+	if (pnum > 1 && (pnum & (pnum - 1)) == 0) {
+		huge_pnum = pnum;
+	}
+}
+
+// Objects smaller than a huge page would only waste the alignment
+static size_t align_for(size_t data_pnum)
+{
+	return huge_pnum != 0 && data_pnum >= huge_pnum ? huge_pnum : 1;
+}
+
+/* Map pnum pages so the data after the header page starts on a multiple of
+ * align_pnum pages. Reserve enough to slide the data to an aligned spot
+ * and hand back what's left over on both sides, so no address space is
+ * wasted on the alignment.
+ */
+static struct large_header *map_object(size_t pnum, size_t align_pnum)
+{
+	size_t ps = page_size();
+	size_t reserve_pnum = pnum + align_pnum - 1;
+	uintptr_t base = (uintptr_t)preserve(reserve_pnum);
+	if (base == 0) {
+		return NULL;
+	}
+	size_t align = align_pnum * ps;
+	uintptr_t data = (base + ps + align - 1) & ~(uintptr_t)(align - 1);
+	uintptr_t start = data - ps;
+	uintptr_t end = start + pnum * ps;
+	uintptr_t reserve_end = base + reserve_pnum * ps;
+	if (start > base) {
+		prelease((void *)base, (start - base) / ps);
+	}
+	if (reserve_end > end) {
+		prelease((void *)end, (reserve_end - end) / ps);
+	}
+	if (pcommit((void *)start, pnum) != 0) {
+		prelease((void *)start, pnum);
+		return NULL;
+	}
+	return (struct large_header *)start;
+}
+
+static inline struct large_header *header_of(void *ptr)
+{
+	return (struct large_header *)((uintptr_t)ptr - page_size());
+}
+
+static inline void *data_of(struct large_header *header)
+{
+	return (void *)((uintptr_t)header + page_size());
+}
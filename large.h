@@ -0,0 +1,30 @@
+#ifndef _LARGE_H
+#define _LARGE_H
+
+#include <stddef.h>
+
+/* An allocator for objects of megabytes and up. Every object is its own
+ * mapping with a header page right before the data that records the size
+ * of the mapping, so lfree is a single munmap without any lookup.
+ * lrealloc grows and shrinks with mremap, which moves page table entries
+ * instead of copying, however big the object is.
+ *
+ * Objects of at least one huge page start on a huge page boundary and are
+ * marked with MADV_HUGEPAGE, as long as transparent huge pages aren't
+ * turned off. They stay aligned when lrealloc has to move them. All
+ * functions are thread safe.
+ */
+
+void *lalloc(size_t size);
+
+// ptr MUST have come from lalloc or lrealloc
+void lfree(void *ptr);
+
+// Resize ptr to size bytes. Returns the new address or NULL on failure,
+// in which case ptr is untouched. A NULL ptr allocates.
+void *lrealloc(void *ptr, size_t size);
+
+// Bytes usable at ptr, which is size rounded up to whole pages
+size_t lusable_size(void *ptr);
+
+#endif // _LARGE_H
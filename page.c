@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
@@ -135,7 +136,7 @@ static struct palloc_state state = {
 	.free_page_num = 0,
 };
 
-static void *find_free_pages(size_t pnum, struct palloc_page_head *extra);
+static void *find_free_pages(size_t pnum);
 static struct palloc_page_head *get_free_page_head();
 
 // Find the internal page head is stored in
@@ -150,11 +151,19 @@ static struct __internal_page *find_internal_page_to_free();
 // Internal functions to get and free pages. These can
 // be altered to support a variety of platforms.
 static void *__map_pages(size_t pnum);
+static void *__map_pages_aligned(size_t pnum, size_t align_pnum);
 static void __unmap_pages(void *addr, size_t len);
+static void *__remap_pages(void *addr, size_t old_len, size_t new_len);
 
 void *palloc(size_t pnum)
 {
-	if (pnum == 0) {
+	return palloc_aligned(pnum, 1);
+}
+
+void *palloc_aligned(size_t pnum, size_t align_pnum)
+{
+	if (pnum == 0 || align_pnum == 0 ||
+	    (align_pnum & (align_pnum - 1)) != 0) {
 		errno = EINVAL;
 		return NULL;
 	}
@@ -168,10 +177,7 @@ void *palloc(size_t pnum)
 	if (free_head != NULL) {
 		__page = find_page_head_container(free_head);
 	} else {
-		// Cannot pass NULL extra because we have no room in
-		// internal pages for a split head
-		struct palloc_page_head extra = { 0 };
-		__page = find_free_pages(1, &extra);
+		__page = find_free_pages(1);
 		__page->page_heads_cap =
 			(page_size() - sizeof(struct __internal_page)) /
 			sizeof(struct palloc_page_head);
@@ -179,18 +185,16 @@ void *palloc(size_t pnum)
 		dlist_add(&__page->head, &state.__head);
 		struct palloc_page_head *pages =
 			__internal_page_pages_ptr(__page);
-		if (extra.addr != NULL) {
-			pages[__page->page_heads_num++] = extra;
-		}
+		memset(pages, 0, __page->page_heads_cap * sizeof(*pages));
 		free_head = &pages[__page->page_heads_num++];
 	}
 	_assert(__page != NULL);
 	_assert(free_head != NULL);
 	// Mark the internal page as used recently
 	__use_internal_page(__page);
-	// extra is NULL becaue we have at least one slot in current internal
-	// page for a palloc_page_head
-	void *pages = find_free_pages(pnum, NULL);
+	// The free list makes no promises about alignment
+	void *pages = align_pnum == 1 ? find_free_pages(pnum) :
+					__map_pages_aligned(pnum, align_pnum);
 	dlist_add(&free_head->head, &state.used_head);
 	free_head->addr = pages;
 	free_head->page_num = pnum;
@@ -225,27 +229,88 @@ void pfree(void *pages)
 		pthread_mutex_unlock(&state.lock);
 		return;
 	}
-	// At this point, we know we are unmapping the user's page, check if
-	// we should unmap __internal_page with old head
-	struct __internal_page *container = find_page_head_container(entry);
+	// At this point, we know we are unmapping the user's page. Release
+	// its head then check if we should unmap an empty __internal_page
+	void *addr = entry->addr;
+	size_t len = entry->page_num * page_size();
+	entry->addr = NULL;
+	--find_page_head_container(entry)->page_heads_num;
 	struct __internal_page *container_to_free =
 		find_internal_page_to_free();
 	if (container_to_free != NULL) {
 		// Delete from internal page list
 		dlist_del(&container_to_free->head);
-		pthread_mutex_unlock(&state.lock);
+	}
+	pthread_mutex_unlock(&state.lock);
+	if (container_to_free != NULL) {
 		__unmap_pages(container_to_free, page_size());
+	}
+	__unmap_pages(addr, len);
+}
 
-	} else {
-		entry->addr = NULL;
-		--container->page_heads_num;
+void *prealloc(void *pages, size_t pnum)
+{
+	if (pnum == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	// Align pages to page boundary
+	pages = (void *)((uintptr_t)pages & ~(page_size() - 1));
+	int found = 0;
+	struct palloc_page_head *entry;
+	pthread_mutex_lock(&state.lock);
+	list_for_each(&state.used_head, entry, struct palloc_page_head, head) {
+		if (entry->addr == pages) {
+			found = 1;
+			break;
+		}
+	}
+	if (found == 0) {
 		pthread_mutex_unlock(&state.lock);
+		errno = EINVAL;
+		return NULL;
 	}
-	__unmap_pages(entry->addr, entry->page_num * page_size());
+	if (entry->page_num == pnum) {
+		pthread_mutex_unlock(&state.lock);
+		return pages;
+	}
+	void *new_pages = __remap_pages(pages, entry->page_num * page_size(),
+					pnum * page_size());
+	if (new_pages != NULL) {
+		entry->addr = new_pages;
+		entry->page_num = pnum;
+	}
+	pthread_mutex_unlock(&state.lock);
+	return new_pages;
 }
 
-// Find pages in free list or by allocating new ones
-static void *find_free_pages(size_t pnum, struct palloc_page_head *extra)
+void *preserve(size_t pnum)
+{
+	if (pnum == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	void *addr = mmap(NULL, pnum * page_size(), PROT_NONE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (addr == MAP_FAILED) {
+		return NULL;
+	}
+	return addr;
+}
+
+int pcommit(void *addr, size_t pnum)
+{
+	return mprotect(addr, pnum * page_size(), PROT_READ | PROT_WRITE);
+}
+
+void prelease(void *addr, size_t pnum)
+{
+	__unmap_pages(addr, pnum * page_size());
+}
+
+// Find pages in free list or by allocating new ones. The caller records
+// the allocation in its own palloc_page_head.
+static void *find_free_pages(size_t pnum)
 {
 	struct palloc_page_head *entry;
 	list_for_each(&state.free_head, entry, struct palloc_page_head, head) {
@@ -257,30 +322,21 @@ static void *find_free_pages(size_t pnum, struct palloc_page_head *extra)
 	if (&entry->head == &state.free_head) {
 		return __map_pages(pnum);
 	}
-	if (entry->page_num < pnum) {
-		return __map_pages(pnum);
-	} else if (entry->page_num == pnum) {
+	void *addr = entry->addr;
+	state.free_page_num -= pnum;
+	if (entry->page_num == pnum) {
+		// Give the free list's head back to its internal page
 		dlist_del(&entry->head);
-		dlist_add(&entry->head, &state.used_head);
-		state.free_page_num -= entry->page_num;
-		return entry->addr;
+		entry->addr = NULL;
+		--find_page_head_container(entry)->page_heads_num;
+		return addr;
 	}
-
 	// At this point we know we have a page in the free list, but
-	// it is too big. If extra == NULL, we can assume caller is
-	// telling us the current internal page has room. If it is not
-	// null, the caller is trying to find an internal page, so we
-	// must put the split palloc_page_head in extra.
-	if (extra == NULL) {
-		extra = get_free_page_head();
-	}
-	extra->page_num = entry->page_num - pnum;
-	extra->addr = entry->addr + (page_size() * pnum);
-	entry->page_num = pnum;
-	dlist_del(&entry->head);
-	dlist_add(&entry->head, &state.used_head);
-	state.free_page_num -= pnum;
-	return entry->addr;
+	// it is too big. Hand out the front and leave the rest in the
+	// free list.
+	entry->addr = (void *)((uintptr_t)addr + page_size() * pnum);
+	entry->page_num -= pnum;
+	return addr;
 }
 
 static struct palloc_page_head *get_free_page_head()
@@ -331,6 +387,10 @@ static struct __internal_page *find_internal_page_to_free()
 	// for deletion. If we find empty ones not marked, mark them for next time.
 	struct __internal_page *entry;
 	list_for_each(&state.__head, entry, struct __internal_page, head) {
+		// The static page was never mapped
+		if (entry == static_internal_page) {
+			continue;
+		}
 		if (entry->page_heads_num == 0 &&
 		    !__give_second_chance(entry)) {
 			return entry;
@@ -350,6 +410,24 @@ static void *__map_pages(size_t pnum)
 	return raw_pages;
 }
 
+// Over map by align_pnum - 1 pages then trim both ends
+static void *__map_pages_aligned(size_t pnum, size_t align_pnum)
+{
+	size_t ps = page_size();
+	size_t len = (pnum + align_pnum - 1) * ps;
+	uintptr_t raw = (uintptr_t)__map_pages(pnum + align_pnum - 1);
+	uintptr_t align = align_pnum * ps;
+	uintptr_t aligned = (raw + align - 1) & ~(align - 1);
+	if (aligned != raw) {
+		__unmap_pages((void *)raw, aligned - raw);
+	}
+	uintptr_t end = aligned + pnum * ps;
+	if (end != raw + len) {
+		__unmap_pages((void *)end, raw + len - end);
+	}
+	return (void *)aligned;
+}
+
 static void __unmap_pages(void *addr, size_t len)
 {
 	_assert(addr != 0);
@@ -361,6 +439,16 @@ static void __unmap_pages(void *addr, size_t len)
 	}
 }
 
+static void *__remap_pages(void *addr, size_t old_len, size_t new_len)
+{
+	_assert(addr != 0);
+	void *raw_pages = mremap(addr, old_len, new_len, MREMAP_MAYMOVE);
+	if (raw_pages == MAP_FAILED) {
+		return NULL;
+	}
+	return raw_pages;
+}
+
 void __unreachable(const char *str)
 {
 	size_t len = strnlen(str, 512);
@@ -9,8 +9,29 @@ int page_size();
 // Allocate pnum pages
 void *palloc(size_t pnum);
 
+// Allocate pnum pages starting at an address that is a multiple of
+// align_pnum pages. align_pnum must be a power of two. Allocators can
+// then find the start of the allocation by masking any address in it.
+void *palloc_aligned(size_t pnum, size_t align_pnum);
+
 // Free a previous page allocation. This pointer MUST be in the first
 // page of the allocation. If it is not ... memory leak.
 void pfree(void *pages);
 
+// Resize a previous page allocation to pnum pages. The kernel moves the
+// page table entries so nothing is copied, but the allocation may move.
+// Returns the new address or NULL on failure (the old one is untouched).
+void *prealloc(void *pages, size_t pnum);
+
+// Reserve pnum pages of address space without making them usable. The
+// reservation is not tracked by palloc and is given back with prelease.
+void *preserve(size_t pnum);
+
+// Make pnum reserved pages starting at addr readable and writable.
+// Returns 0 on success or -1 with errno set.
+int pcommit(void *addr, size_t pnum);
+
+// Give back a reservation from preserve
+void prelease(void *addr, size_t pnum);
+
 #endif // _PAGE_H
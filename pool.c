@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <stdint.h>
+
+#include "kette.h"
+#include "page.h"
+#include "pool.h"
+#include "__utils.h"
+
+// Spans are at least this big so palloc is hit rarely for small objects
+#define SPAN_BYTES_MIN (64 * 1024)
+// and hold at least this many objects for big ones
+#define SPAN_OBJS_MIN 8
+// Keep the first slot on its own cache line away from the span header
+#define SPAN_HEADER_SIZE 64
+// Low bit of pool_span.remote_free
+#define REMOTE_QUEUED 0x1
+
+static void remote_free(struct pool *pool, struct pool_span *span,
+			void *ptr);
+static void span_release(struct pool *pool, struct pool_span *span);
+static struct pool_span *span_create(struct pool *pool);
+static void span_reset(struct pool_span *span);
+static inline struct pool_span *span_of(struct pool *pool, void *ptr);
+
+int pool_init(struct pool *pool, size_t obj_size)
+{
+	if (obj_size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	// Slots have to fit the free list link and stay aligned
+	size_t align = obj_size >= 16 ? 16 : sizeof(void *);
+	obj_size = (obj_size + align - 1) & ~(align - 1);
+	size_t ps = page_size();
+	size_t span_bytes = SPAN_HEADER_SIZE + SPAN_OBJS_MIN * obj_size;
+	if (span_bytes < SPAN_BYTES_MIN) {
+		span_bytes = SPAN_BYTES_MIN;
+	}
+	// Power of two pages so spans can be found by masking
+	size_t span_pages = 1;
+	while (span_pages * ps < span_bytes) {
+		span_pages <<= 1;
+	}
+	pool->obj_size = obj_size;
+	pool->span_pages = span_pages;
+	pool->span_objs = (span_pages * ps - SPAN_HEADER_SIZE) / obj_size;
+	dlist_init(&pool->partial_head);
+	dlist_init(&pool->full_head);
+	pool->empty = NULL;
+	pool->owner = pthread_self();
+	pool->remote_spans = NULL;
+	return 0;
+}
+
+void *pool_alloc(struct pool *pool)
+{
+	if (unlikely(__atomic_load_n(&pool->remote_spans, __ATOMIC_RELAXED) !=
+		     NULL)) {
+		pool_collect(pool);
+	}
+	if (unlikely(list_empty(&pool->partial_head))) {
+		struct pool_span *span = pool->empty;
+		pool->empty = NULL;
+		if (span == NULL) {
+			span = span_create(pool);
+			if (span == NULL) {
+				return NULL;
+			}
+		}
+		dlist_add(&span->spans_head, &pool->partial_head);
+	}
+	struct pool_span *span = list_entry(pool->partial_head.next,
+					    struct pool_span, spans_head);
+	void *ptr = span->free;
+	if (ptr != NULL) {
+		span->free = *(void **)ptr;
+	} else {
+		ptr = (void *)span->bump;
+		span->bump += pool->obj_size;
+	}
+	if (unlikely(++span->used == pool->span_objs)) {
+		dlist_del(&span->spans_head);
+		dlist_add(&span->spans_head, &pool->full_head);
+	}
+	return ptr;
+}
+
+void pool_free(struct pool *pool, void *ptr)
+{
+	struct pool_span *span = span_of(pool, ptr);
+	if (unlikely(!pthread_equal(pthread_self(), pool->owner))) {
+		remote_free(pool, span, ptr);
+		return;
+	}
+	*(void **)ptr = span->free;
+	span->free = ptr;
+	if (unlikely(span->used-- == pool->span_objs)) {
+		dlist_del(&span->spans_head);
+		dlist_add(&span->spans_head, &pool->partial_head);
+	}
+	// Uncollected remote frees count as used, so an empty span is
+	// never queued
+	if (unlikely(span->used == 0)) {
+		span_release(pool, span);
+	}
+}
+
+void pool_collect(struct pool *pool)
+{
+	struct pool_span *span = __atomic_exchange_n(&pool->remote_spans, NULL,
+						     __ATOMIC_ACQUIRE);
+	while (span != NULL) {
+		struct pool_span *next = span->remote_next;
+		// Taking the list also clears REMOTE_QUEUED, so the next
+		// remote free queues the span again. Release pairs with the
+		// acquire in remote_free, so remote_next was read above before
+		// that free writes it.
+		uintptr_t list = __atomic_exchange_n(&span->remote_free, 0,
+						     __ATOMIC_ACQ_REL);
+		void *obj = (void *)(list & ~(uintptr_t)REMOTE_QUEUED);
+		int was_full = span->used == pool->span_objs;
+		while (obj != NULL) {
+			void *obj_next = *(void **)obj;
+			*(void **)obj = span->free;
+			span->free = obj;
+			--span->used;
+			obj = obj_next;
+		}
+		if (was_full && span->used < pool->span_objs) {
+			dlist_del(&span->spans_head);
+			dlist_add(&span->spans_head, &pool->partial_head);
+		}
+		// Remote frees still in flight are counted in used
+		if (span->used == 0) {
+			span_release(pool, span);
+		}
+		span = next;
+	}
+}
+
+void pool_destroy(struct pool *pool)
+{
+	struct dlink *heads[] = { &pool->partial_head, &pool->full_head };
+	for (int i = 0; i < 2; ++i) {
+		struct dlink *next;
+		for (struct dlink *d = heads[i]->next; d != heads[i]; d = next) {
+			next = d->next;
+			pfree(list_entry(d, struct pool_span, spans_head));
+		}
+		dlist_init(heads[i]);
+	}
+	if (pool->empty != NULL) {
+		pfree(pool->empty);
+		pool->empty = NULL;
+	}
+}
+
+// Push onto the span's remote list with one CAS that also sets
+// REMOTE_QUEUED. If it wasn't set, the span isn't queued yet and nothing
+// can collect it until we queue it, so it is safe to touch the span after
+// the CAS. Otherwise the CAS is the last access, since the owner may
+// collect and release the span right after it.
+static void remote_free(struct pool *pool, struct pool_span *span, void *ptr)
+{
+	uintptr_t head = __atomic_load_n(&span->remote_free, __ATOMIC_RELAXED);
+	do {
+		*(void **)ptr = (void *)(head & ~(uintptr_t)REMOTE_QUEUED);
+	} while (!__atomic_compare_exchange_n(
+		&span->remote_free, &head, (uintptr_t)ptr | REMOTE_QUEUED, 1,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	if (head & REMOTE_QUEUED) {
+		return;
+	}
+	struct pool_span *spans =
+		__atomic_load_n(&pool->remote_spans, __ATOMIC_RELAXED);
+	do {
+		span->remote_next = spans;
+	} while (!__atomic_compare_exchange_n(&pool->remote_spans, &spans,
+					      span, 1, __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+}
+
+// Drop an empty span, keeping one around for reuse
+static void span_release(struct pool *pool, struct pool_span *span)
+{
+	dlist_del(&span->spans_head);
+	if (pool->empty == NULL) {
+		span_reset(span);
+		pool->empty = span;
+	} else {
+		pfree(span);
+	}
+}
+
+static struct pool_span *span_create(struct pool *pool)
+{
+	struct pool_span *span =
+		palloc_aligned(pool->span_pages, pool->span_pages);
+	if (span == NULL) {
+		return NULL;
+	}
+	span_reset(span);
+	return span;
+}
+
+// Slots are carved lazily with bump so new spans are never walked
+static void span_reset(struct pool_span *span)
+{
+	span->free = NULL;
+	span->bump = (uintptr_t)span + SPAN_HEADER_SIZE;
+	span->used = 0;
+	span->remote_free = 0;
+	span->remote_next = NULL;
+}
+
+static inline struct pool_span *span_of(struct pool *pool, void *ptr)
+{
+	uintptr_t mask = pool->span_pages * page_size() - 1;
+	return (struct pool_span *)((uintptr_t)ptr & ~mask);
+}
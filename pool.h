@@ -0,0 +1,67 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kette.h"
+
+/* A pool hands out objects of one fixed size. Objects are carved out of
+ * spans from palloc_aligned, so the span an object belongs to is found by
+ * masking its address. Free objects are kept in an intrusive list inside
+ * each span, which makes pool_alloc and pool_free O(1).
+ *
+ * A pool is owned by the thread that called pool_init and only that
+ * thread may call pool_alloc. Any thread may call pool_free. Frees from
+ * other threads are pushed onto a per span remote list with one CAS and
+ * the owner collects each list in one go the next time it allocates.
+ */
+
+// Header at the start of every span
+struct pool_span {
+	struct dlink spans_head;
+	// Intrusive list of freed slots
+	void *free;
+	// Next slot that has never been handed out
+	uintptr_t bump;
+	// Slots handed out, counting remote frees not yet collected
+	size_t used;
+	// Slots freed by other threads, collected by the owner. The low bit
+	// is set while the span is queued on the pool's remote_spans.
+	uintptr_t remote_free;
+	struct pool_span *remote_next;
+};
+
+struct pool {
+	size_t obj_size;
+	size_t span_pages;
+	size_t span_objs;
+	// Spans with at least one free slot. Allocation uses the first one.
+	struct dlink partial_head;
+	struct dlink full_head;
+	// One empty span is kept around so a pool that drains and refills
+	// doesn't hit palloc every time.
+	struct pool_span *empty;
+	pthread_t owner;
+	// Spans other threads have freed into since the last collection
+	struct pool_span *remote_spans;
+};
+
+// Set up a pool for objects of obj_size bytes. Returns 0 on success or -1
+// if obj_size is 0.
+int pool_init(struct pool *pool, size_t obj_size);
+
+void *pool_alloc(struct pool *pool);
+
+// ptr MUST have come from pool. Safe to call from any thread.
+void pool_free(struct pool *pool, void *ptr);
+
+// Take back everything other threads have freed. pool_alloc does this on
+// its own; only the owner may call it.
+void pool_collect(struct pool *pool);
+
+// Free every span, including objects that are still allocated
+void pool_destroy(struct pool *pool);
+
+#endif // _POOL_H
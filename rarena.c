@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "page.h"
+#include "rarena.h"
+
+// "RARENA" followed by the format version when stored little endian
+#define RARENA_MAGIC 0x0001414E45524152ULL
+#define RARENA_ALIGN 16
+#define RARENA_SEALS \
+	(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+static size_t bytes_to_page(size_t bytes, int page_size);
+static void header_init(struct rarena_header *base);
+static void *grow_span(struct rarena *ra, size_t cap);
+static int map_readonly(struct rarena *ra, int fd);
+static int write_all(int fd, const void *buf, size_t len);
+
+int rarena_init(struct rarena *ra, size_t initial_bytes)
+{
+	int ps = page_size();
+	size_t num_pages = bytes_to_page(initial_bytes + sizeof(*ra->base), ps);
+	struct rarena_header *base = palloc(num_pages);
+	if (base == NULL) {
+		return -1;
+	}
+	header_init(base);
+	ra->base = base;
+	ra->cap = num_pages * ps;
+	ra->flags = 0;
+	ra->fd = -1;
+	return 0;
+}
+
+int rarena_init_memfd(struct rarena *ra, const char *name,
+		      size_t initial_bytes)
+{
+	int ps = page_size();
+	size_t cap = bytes_to_page(initial_bytes + sizeof(*ra->base), ps) * ps;
+	int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, cap) != 0) {
+		close(fd);
+		return -1;
+	}
+	void *base =
+		mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	header_init(base);
+	ra->base = base;
+	ra->cap = cap;
+	ra->flags = RARENA_MAPPED;
+	ra->fd = fd;
+	return 0;
+}
+
+roff_t rarena_alloc(struct rarena *ra, size_t bytes)
+{
+	if (ra->flags & RARENA_READONLY) {
+		errno = EROFS;
+		return ROFF_NULL;
+	}
+	size_t aligned = (bytes + RARENA_ALIGN - 1) & ~(RARENA_ALIGN - 1);
+	roff_t off = ra->base->used;
+	if (off + aligned > ra->cap) {
+		// Grow geometrically, prealloc moves page tables not data
+		int ps = page_size();
+		size_t cap = ra->cap * 2;
+		if (cap < off + aligned) {
+			cap = off + aligned;
+		}
+		cap = bytes_to_page(cap, ps) * ps;
+		struct rarena_header *base = grow_span(ra, cap);
+		if (base == NULL) {
+			return ROFF_NULL;
+		}
+		ra->base = base;
+		ra->cap = cap;
+	}
+	ra->base->used = off + aligned;
+	return off;
+}
+
+void rarena_set_root(struct rarena *ra, roff_t root)
+{
+	ra->base->root = root;
+}
+
+roff_t rarena_root(const struct rarena *ra)
+{
+	return ra->base->root;
+}
+
+int rarena_seal(struct rarena *ra)
+{
+	if (ra->fd < 0 || (ra->flags & RARENA_READONLY)) {
+		errno = EINVAL;
+		return -1;
+	}
+	// F_SEAL_WRITE fails while a writable shared mapping exists
+	size_t used = ra->base->used;
+	munmap(ra->base, ra->cap);
+	ra->base = NULL;
+	if (ftruncate(ra->fd, used) != 0 ||
+	    fcntl(ra->fd, F_ADD_SEALS, RARENA_SEALS) != 0) {
+		return -1;
+	}
+	return map_readonly(ra, ra->fd);
+}
+
+int rarena_fd(const struct rarena *ra)
+{
+	return ra->fd;
+}
+
+int rarena_attach(struct rarena *ra, int fd)
+{
+	// Only trust the contents if nobody can change them under us
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0) {
+		return -1;
+	}
+	if ((seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) !=
+	    (F_SEAL_WRITE | F_SEAL_SHRINK)) {
+		errno = EPERM;
+		return -1;
+	}
+	if (map_readonly(ra, fd) != 0) {
+		return -1;
+	}
+	ra->fd = -1;
+	return 0;
+}
+
+int rarena_save(const struct rarena *ra, const char *path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	int err = write_all(fd, ra->base, ra->base->used);
+	if (close(fd) != 0) {
+		err = -1;
+	}
+	return err;
+}
+
+int rarena_load_mmap(struct rarena *ra, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	int err = map_readonly(ra, fd);
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if (err == 0) {
+		ra->fd = -1;
+	}
+	return err;
+}
+
+void rarena_free(struct rarena *ra)
+{
+	if (ra->base != NULL) {
+		if (ra->flags & RARENA_MAPPED) {
+			munmap(ra->base, ra->cap);
+		} else {
+			pfree(ra->base);
+		}
+	}
+	if (ra->fd >= 0) {
+		close(ra->fd);
+		ra->fd = -1;
+	}
+	ra->base = NULL;
+	ra->cap = 0;
+}
+
+static void header_init(struct rarena_header *base)
+{
+	base->magic = RARENA_MAGIC;
+	base->used = (sizeof(*base) + RARENA_ALIGN - 1) & ~(RARENA_ALIGN - 1);
+	base->root = ROFF_NULL;
+}
+
+// Resize the span to cap bytes. The memfd has to grow first so the new
+// part of the mapping is backed by the file.
+static void *grow_span(struct rarena *ra, size_t cap)
+{
+	if (ra->fd < 0) {
+		return prealloc(ra->base, cap / page_size());
+	}
+	if (ftruncate(ra->fd, cap) != 0) {
+		return NULL;
+	}
+	void *base = mremap(ra->base, ra->cap, cap, MREMAP_MAYMOVE);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	return base;
+}
+
+// Map all of fd read only and check it holds a relocatable arena
+static int map_readonly(struct rarena *ra, int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return -1;
+	}
+	size_t len = st.st_size;
+	if (len < sizeof(struct rarena_header)) {
+		errno = EINVAL;
+		return -1;
+	}
+	void *base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+	struct rarena_header *header = base;
+	if (header->magic != RARENA_MAGIC || header->used > len) {
+		munmap(base, len);
+		errno = EINVAL;
+		return -1;
+	}
+	ra->base = header;
+	ra->cap = len;
+	ra->flags = RARENA_READONLY | RARENA_MAPPED;
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *curr = buf;
+	while (len > 0) {
+		ssize_t n = write(fd, curr, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		curr += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static size_t bytes_to_page(size_t bytes, int ps)
+{
+	size_t num_pages = bytes / ps;
+	if (bytes % ps != 0) {
+		++num_pages;
+	}
+	return num_pages;
+}
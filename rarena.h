@@ -0,0 +1,99 @@
+#ifndef _RARENA_H
+#define _RARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A relocatable arena is one contiguous span of memory. Objects inside it
+ * refer to each other with offsets from the start of the span instead of
+ * pointers, so the whole span can be written to a file and mapped back in
+ * at any address without any fixups.
+ */
+
+// Offset of an object from the start of a relocatable arena. Offset 0 is
+// the header so it is never a valid object.
+typedef uint64_t roff_t;
+#define ROFF_NULL ((roff_t)0)
+
+// The span was mapped in from a file or sealed and cannot be allocated from
+#define RARENA_READONLY 0x1
+// The span is mapped directly instead of coming from palloc
+#define RARENA_MAPPED 0x2
+
+// Stored at offset 0 of every relocatable arena and snapshot
+struct rarena_header {
+	uint64_t magic;
+	uint64_t used;
+	roff_t root;
+};
+
+struct rarena {
+	struct rarena_header *base;
+	size_t cap;
+	unsigned int flags;
+	// memfd backing the span or -1
+	int fd;
+};
+
+static inline void *roff_ptr(const struct rarena *ra, roff_t off)
+{
+	if (off == ROFF_NULL) {
+		return NULL;
+	}
+	return (char *)ra->base + off;
+}
+
+static inline roff_t roff_from_ptr(const struct rarena *ra, const void *ptr)
+{
+	if (ptr == NULL) {
+		return ROFF_NULL;
+	}
+	return (roff_t)((const char *)ptr - (const char *)ra->base);
+}
+
+// Create a relocatable arena with room for initial_bytes. Returns 0 on
+// success or -1 on failure.
+int rarena_init(struct rarena *ra, size_t initial_bytes);
+
+// Allocate bytes and return the offset of the allocation. The span may
+// move when it grows, so pointers from roff_ptr are only good until the
+// next allocation. Returns ROFF_NULL on failure.
+roff_t rarena_alloc(struct rarena *ra, size_t bytes);
+
+// The root is the entry point to the data structures in the arena
+void rarena_set_root(struct rarena *ra, roff_t root);
+
+roff_t rarena_root(const struct rarena *ra);
+
+// Write the used part of the arena to path. Returns 0 on success or -1
+// with errno set.
+int rarena_save(const struct rarena *ra, const char *path);
+
+// Map a snapshot from rarena_save read only. The data is used in place so
+// this costs one mmap. Returns 0 on success or -1 with errno set.
+int rarena_load_mmap(struct rarena *ra, const char *path);
+
+// Create a relocatable arena backed by a memfd so it can be shared with
+// other processes. Returns 0 on success or -1 with errno set.
+int rarena_init_memfd(struct rarena *ra, const char *name,
+		      size_t initial_bytes);
+
+// Freeze a memfd backed arena. The file is trimmed to the used size, the
+// span is remapped read only and the memfd is sealed against writes,
+// resizing and further sealing. Returns 0 on success or -1 with errno set,
+// after which the arena can only be freed.
+int rarena_seal(struct rarena *ra);
+
+// The memfd to hand to other processes (fork or SCM_RIGHTS). -1 if the
+// arena is not memfd backed. The arena keeps ownership of it.
+int rarena_fd(const struct rarena *ra);
+
+// Map a sealed arena from another process's memfd read only. This costs
+// one mmap; fd is not taken over and may be closed afterwards. Returns 0
+// on success or -1 with errno set.
+int rarena_attach(struct rarena *ra, int fd);
+
+// Free a created arena or unmap a loaded or attached one
+void rarena_free(struct rarena *ra);
+
+#endif // _RARENA_H
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "page.h"
+#include "ring.h"
+
+int ring_init(struct ring *ring, size_t bytes)
+{
+	int ps = page_size();
+	size_t num_pages = 1;
+	while (num_pages * ps < bytes) {
+		num_pages <<= 1;
+	}
+	size_t size = num_pages * ps;
+	int fd = memfd_create("ring", MFD_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		return -1;
+	}
+	// Reserve room for both views then map the memfd over each half
+	char *base = preserve(2 * num_pages);
+	if (base == NULL) {
+		close(fd);
+		return -1;
+	}
+	for (int i = 0; i < 2; ++i) {
+		void *view = mmap(base + i * size, size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_FIXED, fd, 0);
+		if (view == MAP_FAILED) {
+			int err = errno;
+			prelease(base, 2 * num_pages);
+			close(fd);
+			errno = err;
+			return -1;
+		}
+	}
+	// The mappings keep the memfd alive
+	close(fd);
+	ring->base = base;
+	ring->size = size;
+	ring->head = 0;
+	ring->tail_cache = 0;
+	ring->tail = 0;
+	ring->head_cache = 0;
+	return 0;
+}
+
+void *ring_reserve(struct ring *ring, size_t bytes)
+{
+	if (ring->size - (ring->head - ring->tail) < bytes) {
+		return NULL;
+	}
+	return ring->base + (ring->head & (ring->size - 1));
+}
+
+void ring_commit(struct ring *ring, size_t bytes)
+{
+	ring->head += bytes;
+}
+
+void *ring_peek(struct ring *ring, size_t *bytes)
+{
+	*bytes = ring->head - ring->tail;
+	if (*bytes == 0) {
+		return NULL;
+	}
+	return ring->base + (ring->tail & (ring->size - 1));
+}
+
+void ring_release(struct ring *ring, size_t bytes)
+{
+	ring->tail += bytes;
+}
+
+void *ring_spsc_reserve(struct ring *ring, size_t bytes)
+{
+	size_t head = ring->head;
+	if (ring->size - (head - ring->tail_cache) < bytes) {
+		// Pairs with the release in ring_spsc_release so the
+		// consumer is done reading the space we reuse
+		ring->tail_cache =
+			__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->size - (head - ring->tail_cache) < bytes) {
+			return NULL;
+		}
+	}
+	return ring->base + (head & (ring->size - 1));
+}
+
+void ring_spsc_commit(struct ring *ring, size_t bytes)
+{
+	__atomic_store_n(&ring->head, ring->head + bytes, __ATOMIC_RELEASE);
+}
+
+void *ring_spsc_peek(struct ring *ring, size_t *bytes)
+{
+	size_t tail = ring->tail;
+	if (ring->head_cache == tail) {
+		// Pairs with the release in ring_spsc_commit so the data
+		// is visible before we read it
+		ring->head_cache =
+			__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+	*bytes = ring->head_cache - tail;
+	if (*bytes == 0) {
+		return NULL;
+	}
+	return ring->base + (tail & (ring->size - 1));
+}
+
+void ring_spsc_release(struct ring *ring, size_t bytes)
+{
+	__atomic_store_n(&ring->tail, ring->tail + bytes, __ATOMIC_RELEASE);
+}
+
+void ring_destroy(struct ring *ring)
+{
+	prelease(ring->base, 2 * ring->size / page_size());
+	ring->base = NULL;
+}
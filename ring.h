@@ -0,0 +1,58 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <stddef.h>
+
+/* A "magic" ring buffer. The same memfd is mapped twice, back to back,
+ * so a record that wraps past the end of the buffer is still contiguous
+ * in memory and never has to be copied back together.
+ *
+ * head and tail only ever increase. The producer reserves space at head
+ * and commits what it wrote, the consumer peeks at tail and releases
+ * what it has read. The ring_spsc_ functions do the same with atomic
+ * indices so one producer thread and one consumer thread can share a
+ * ring without a lock. Don't mix the two on one ring.
+ */
+
+#define RING_CACHE_LINE 64
+
+struct ring {
+	char *base;
+	size_t size;
+	// Producer side
+	_Alignas(RING_CACHE_LINE) size_t head;
+	// Last tail the producer saw, saves rereading the consumer's line
+	size_t tail_cache;
+	// Consumer side
+	_Alignas(RING_CACHE_LINE) size_t tail;
+	size_t head_cache;
+};
+
+// Set up a ring of at least bytes, rounded up to a power of two number
+// of pages. Returns 0 on success or -1 with errno set.
+int ring_init(struct ring *ring, size_t bytes);
+
+// Contiguous space for bytes at head, or NULL if the ring is too full
+void *ring_reserve(struct ring *ring, size_t bytes);
+
+// Publish bytes written at the last reservation
+void ring_commit(struct ring *ring, size_t bytes);
+
+// Contiguous readable data at tail. Its length is stored in bytes and
+// NULL is returned if the ring is empty.
+void *ring_peek(struct ring *ring, size_t *bytes);
+
+// Drop bytes that have been read from tail
+void ring_release(struct ring *ring, size_t bytes);
+
+void *ring_spsc_reserve(struct ring *ring, size_t bytes);
+
+void ring_spsc_commit(struct ring *ring, size_t bytes);
+
+void *ring_spsc_peek(struct ring *ring, size_t *bytes);
+
+void ring_spsc_release(struct ring *ring, size_t bytes);
+
+void ring_destroy(struct ring *ring);
+
+#endif // _RING_H
@@ -0,0 +1,612 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__SANITIZE_THREAD__)
+#define SLAB_TSAN
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define SLAB_TSAN
+#endif
+#endif
+// The critical sections are written in x86-64 assembly. ThreadSanitizer
+// can't see into them and would report every object handed from one
+// thread to another through a CPU's cache.
+#if defined(__x86_64__) && !defined(SLAB_TSAN) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define SLAB_HAVE_RSEQ
+#endif
+
+#include "bitmap.h"
+#include "kette.h"
+#include "page.h"
+#include "slab.h"
+#include "__utils.h"
+
+// Every slab, and every allocation too big for one, starts at a multiple
+// of this so its header is at ptr & ~(SLAB_BYTES - 1)
+#define SLAB_BYTES (128 * 1024)
+// The header, then the free slot bitmap, then the objects on their own
+// cache line
+#define SLAB_HEADER_SIZE 64
+#define SLAB_LINE 64
+// Requests up to this size find their class with one table lookup
+#define SLAB_LOOKUP_MAX 1024
+
+// Objects each cache holds per class. A miss or overflow moves half of
+// that to or from the class in one lock hold.
+#define SLAB_CACHE_OBJS 32
+
+#define SLAB_KIND_SMALL 0x51AB
+#define SLAB_KIND_LARGE 0x1A26E
+
+/* Header at the start of every slab. Allocations bigger than
+ * SLAB_SIZE_MAX get one too so sfree can tell them apart.
+ */
+struct slab {
+	struct dlink slabs_head;
+	unsigned int kind;
+	unsigned int class_idx;
+	// First bitmap word that may have a free slot
+	size_t hint;
+	// Objects in use, or pages for large allocations
+	size_t used;
+};
+
+/* One per size class.
+ *
+ * lock         -> Protects everything below.
+ * partial_head -> Slabs with at least one free object.
+ * full_head    -> Slabs with none.
+ * empty        -> One empty slab kept so a class doesn't thrash palloc.
+ * objs         -> Objects per slab.
+ * words        -> Bitmap words per slab.
+ * data_offset  -> Offset of the first object from the slab.
+ * recip        -> 2^32 / size rounded up, to turn an object's offset into
+ *                 its index without dividing.
+ */
+struct slab_class {
+	pthread_mutex_t lock;
+	struct dlink partial_head;
+	struct dlink full_head;
+	struct slab *empty;
+	size_t objs;
+	size_t words;
+	size_t data_offset;
+	uint64_t recip;
+};
+
+// Four classes per doubling past 128 bytes keeps waste under 25%
+static const unsigned int class_sizes[SLAB_CLASS_NUM] = {
+	8,     16,    24,    32,    40,    48,    56,    64,    80,    96,
+	112,   128,   160,   192,   224,   256,   320,   384,   448,   512,
+	640,   768,   896,   1024,  1280,  1536,  1792,  2048,  2560,  3072,
+	3584,  4096,  5120,  6144,  7168,  8192,  10240, 12288, 14336, 16384,
+};
+
+// Free objects of one class, count of them at the front of objs
+struct slab_cache_bin {
+	size_t count;
+	void *objs[SLAB_CACHE_OBJS];
+};
+
+/* A front cache of free objects for every class. There is one per CPU,
+ * indexed with the CPU id the kernel keeps up to date in the thread's rseq
+ * area, so thousands of threads on a few cores share a few caches. Every
+ * push and pop is an rseq critical section that ends in a single store of
+ * count. The kernel restarts it if the thread is preempted, migrated or
+ * signalled before that store, so nothing is ever locked and a preempted
+ * thread never holds anyone up. Without rseq every thread gets its own
+ * cache instead, which only that thread touches.
+ */
+struct slab_cache {
+	_Alignas(64) struct slab_cache_bin bins[SLAB_CLASS_NUM];
+};
+
+static struct slab_class classes[SLAB_CLASS_NUM];
+static struct slab_cache *cpu_caches;
+static unsigned int cpu_cache_num;
+static __thread struct slab_cache thread_cache;
+static __thread int thread_cache_used;
+static pthread_key_t thread_cache_key;
+// Class index for every multiple of 8 up to SLAB_LOOKUP_MAX
+static unsigned char small_class[SLAB_LOOKUP_MAX / 8 + 1];
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void slab_init();
+static unsigned int size_to_class(size_t size);
+#ifdef SLAB_HAVE_RSEQ
+static inline struct rseq *rseq_area();
+#endif
+static inline int cache_pop(unsigned int class_idx, void **ptr);
+static inline int cache_push(unsigned int class_idx, void *ptr);
+static void *cache_refill(unsigned int class_idx);
+static void cache_flush(unsigned int class_idx, void *ptr);
+static inline struct slab_cache *thread_cache_get();
+static void thread_cache_flush(void *cache);
+static size_t class_alloc_bulk(unsigned int class_idx, void **objs,
+			       size_t num);
+static void class_free_bulk(unsigned int class_idx, void **objs, size_t num);
+static struct slab *slab_create(unsigned int class_idx);
+static void slab_reset(struct slab *slab);
+static inline uint64_t *slab_bitmap(struct slab *slab);
+static void *large_alloc(size_t size);
+static inline struct slab *slab_of(void *ptr);
+static size_t slab_pages();
+
+void *salloc(size_t size)
+{
+	pthread_once(&slab_once, slab_init);
+	if (unlikely(size > SLAB_SIZE_MAX)) {
+		return large_alloc(size);
+	}
+	unsigned int class_idx = size_to_class(size);
+	void *ptr;
+	if (likely(cache_pop(class_idx, &ptr))) {
+		return ptr;
+	}
+	return cache_refill(class_idx);
+}
+
+void sfree(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	struct slab *slab = slab_of(ptr);
+	if (unlikely(slab->kind == SLAB_KIND_LARGE)) {
+		pfree(slab);
+		return;
+	}
+	unsigned int class_idx = slab->class_idx;
+	if (likely(cache_push(class_idx, ptr))) {
+		return;
+	}
+	cache_flush(class_idx, ptr);
+}
+
+void *srealloc(void *ptr, size_t size)
+{
+	if (ptr == NULL) {
+		return salloc(size);
+	}
+	if (size == 0) {
+		sfree(ptr);
+		return NULL;
+	}
+	size_t usable = susable_size(ptr);
+	if (size <= usable) {
+		return ptr;
+	}
+	void *new_ptr = salloc(size);
+	if (new_ptr == NULL) {
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, usable);
+	sfree(ptr);
+	return new_ptr;
+}
+
+size_t susable_size(void *ptr)
+{
+	struct slab *slab = slab_of(ptr);
+	if (slab->kind == SLAB_KIND_LARGE) {
+		return slab->used * page_size() - SLAB_HEADER_SIZE;
+	}
+	return class_sizes[slab->class_idx];
+}
+
+static void slab_init()
+{
+	size_t slab_bytes = slab_pages() * page_size();
+	for (unsigned int i = 0; i < SLAB_CLASS_NUM; ++i) {
+		struct slab_class *class = &classes[i];
+		pthread_mutex_init(&class->lock, NULL);
+		dlist_init(&class->partial_head);
+		dlist_init(&class->full_head);
+		class->empty = NULL;
+		// Start from what fits without a bitmap and give objects back
+		// until the bitmap fits too
+		size_t objs = (slab_bytes - SLAB_HEADER_SIZE) / class_sizes[i];
+		size_t offset;
+		for (;; --objs) {
+			offset = SLAB_HEADER_SIZE +
+				 BITMAP_WORDS(objs) * sizeof(uint64_t);
+			offset = (offset + SLAB_LINE - 1) & ~(size_t)(SLAB_LINE - 1);
+			if (offset + objs * class_sizes[i] <= slab_bytes) {
+				break;
+			}
+		}
+		class->objs = objs;
+		class->words = BITMAP_WORDS(objs);
+		class->data_offset = offset;
+		class->recip = (((uint64_t)1 << 32) + class_sizes[i] - 1) /
+			       class_sizes[i];
+	}
+	unsigned int class_idx = 0;
+	for (unsigned int i = 0; i <= SLAB_LOOKUP_MAX / 8; ++i) {
+		while (class_sizes[class_idx] < i * 8) {
+			++class_idx;
+		}
+		small_class[i] = class_idx;
+	}
+	pthread_key_create(&thread_cache_key, thread_cache_flush);
+#ifdef SLAB_HAVE_RSEQ
+	// glibc registers rseq for every thread when the kernel supports it
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (__rseq_size > 0 && (int)rseq_area()->cpu_id >= 0 && cpus > 0) {
+		int ps = page_size();
+		size_t bytes = cpus * sizeof(struct slab_cache);
+		cpu_caches = palloc((bytes + ps - 1) / ps);
+		if (cpu_caches != NULL) {
+			memset(cpu_caches, 0, bytes);
+			cpu_cache_num = cpus;
+		}
+	}
+#endif
+}
+
+#ifdef SLAB_HAVE_RSEQ
+#define RSEQ_STR_(x) #x
+#define RSEQ_STR(x) RSEQ_STR_(x)
+
+/* Start of a critical section on the CPU in operand cpu. Its descriptor
+ * goes in its own section as label 3 and covers labels 1 to 2, with
+ * label 4 as the abort handler. Storing the descriptor's address in the
+ * thread's rseq area arms it, and from label 1 on the kernel sends the
+ * thread to 4 if it is interrupted. The CPU id is checked first since the
+ * thread may have moved since it picked the bin.
+ */
+#define RSEQ_ASM_BEGIN                          \
+	".pushsection __rseq_cs, \"aw\"\n\t"    \
+	".balign 32\n\t"                        \
+	"3:\n\t"                                \
+	".long 0, 0\n\t"                        \
+	".quad 1f, 2f - 1f, 4f\n\t"             \
+	".popsection\n\t"                       \
+	"leaq 3b(%%rip), %%rax\n\t"             \
+	"movq %%rax, %[rseq_cs]\n\t"            \
+	"1:\n\t"                                \
+	"cmpl %[cpu], %[cpu_id]\n\t"            \
+	"jnz 4f\n\t"
+
+/* End of a critical section, right after the store that commits it. The
+ * abort handler has to follow the signature glibc registered rseq with,
+ * hidden in an undefined instruction so it never runs.
+ */
+#define RSEQ_ASM_END                            \
+	"2:\n\t"                                \
+	".pushsection __rseq_failure, \"ax\"\n\t" \
+	".byte 0x0f, 0xb9, 0x3d\n\t"            \
+	".long " RSEQ_STR(RSEQ_SIG) "\n\t"      \
+	"4:\n\t"                                \
+	"jmp %l[abort]\n\t"                     \
+	".popsection\n\t"
+
+static inline struct rseq *rseq_area()
+{
+	return (struct rseq *)((char *)__builtin_thread_pointer() +
+			       __rseq_offset);
+}
+
+// Pop from bin, which belongs to cpu. Returns 1 with the object in *ptr,
+// 0 if the bin is empty, or -1 if the thread was interrupted and has to
+// pick a bin again.
+static inline int rseq_pop(struct slab_cache_bin *bin, unsigned int cpu,
+			   void **ptr)
+{
+	struct rseq *rs = rseq_area();
+	__asm__ __volatile__ goto(RSEQ_ASM_BEGIN
+				  "movq %[count], %%rbx\n\t"
+				  "testq %%rbx, %%rbx\n\t"
+				  "jz %l[empty]\n\t"
+				  "movq -8(%[objs], %%rbx, 8), %%rcx\n\t"
+				  "movq %%rcx, (%[ptr])\n\t"
+				  "decq %%rbx\n\t"
+				  "movq %%rbx, %[count]\n\t"
+				  RSEQ_ASM_END
+				  :
+				  : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id),
+				    [rseq_cs] "m"(rs->rseq_cs),
+				    [count] "m"(bin->count),
+				    [objs] "r"(bin->objs), [ptr] "r"(ptr)
+				  : "memory", "cc", "rax", "rbx", "rcx"
+				  : abort, empty);
+	return 1;
+abort:
+	return -1;
+empty:
+	return 0;
+}
+
+// Push onto bin, which belongs to cpu. Returns 1 on success, 0 if the bin
+// is full, or -1 if the thread was interrupted and has to pick a bin
+// again.
+static inline int rseq_push(struct slab_cache_bin *bin, unsigned int cpu,
+			    void *ptr)
+{
+	struct rseq *rs = rseq_area();
+	__asm__ __volatile__ goto(RSEQ_ASM_BEGIN
+				  "movq %[count], %%rbx\n\t"
+				  "cmpq %[max], %%rbx\n\t"
+				  "jae %l[full]\n\t"
+				  "movq %[ptr], (%[objs], %%rbx, 8)\n\t"
+				  "incq %%rbx\n\t"
+				  "movq %%rbx, %[count]\n\t"
+				  RSEQ_ASM_END
+				  :
+				  : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id),
+				    [rseq_cs] "m"(rs->rseq_cs),
+				    [count] "m"(bin->count),
+				    [objs] "r"(bin->objs), [ptr] "r"(ptr),
+				    [max] "i"(SLAB_CACHE_OBJS)
+				  : "memory", "cc", "rax", "rbx"
+				  : abort, full);
+	return 1;
+abort:
+	return -1;
+full:
+	return 0;
+}
+#endif
+
+// Pop a free object of class_idx from this CPU's cache, or this thread's
+// if rseq isn't there. Returns 0 if the cache is empty.
+static inline int cache_pop(unsigned int class_idx, void **ptr)
+{
+#ifdef SLAB_HAVE_RSEQ
+	if (likely(cpu_caches != NULL)) {
+		for (;;) {
+			unsigned int cpu = __atomic_load_n(
+				&rseq_area()->cpu_id_start, __ATOMIC_RELAXED);
+			if (unlikely(cpu >= cpu_cache_num)) {
+				break;
+			}
+			int ret = rseq_pop(&cpu_caches[cpu].bins[class_idx],
+					   cpu, ptr);
+			if (likely(ret >= 0)) {
+				return ret;
+			}
+		}
+	}
+#endif
+	struct slab_cache_bin *bin = &thread_cache_get()->bins[class_idx];
+	if (bin->count == 0) {
+		return 0;
+	}
+	*ptr = bin->objs[--bin->count];
+	return 1;
+}
+
+// Push a free object of class_idx. Returns 0 if the cache is full.
+static inline int cache_push(unsigned int class_idx, void *ptr)
+{
+#ifdef SLAB_HAVE_RSEQ
+	if (likely(cpu_caches != NULL)) {
+		for (;;) {
+			unsigned int cpu = __atomic_load_n(
+				&rseq_area()->cpu_id_start, __ATOMIC_RELAXED);
+			if (unlikely(cpu >= cpu_cache_num)) {
+				break;
+			}
+			int ret = rseq_push(&cpu_caches[cpu].bins[class_idx],
+					    cpu, ptr);
+			if (likely(ret >= 0)) {
+				return ret;
+			}
+		}
+	}
+#endif
+	struct slab_cache_bin *bin = &thread_cache_get()->bins[class_idx];
+	if (bin->count == SLAB_CACHE_OBJS) {
+		return 0;
+	}
+	bin->objs[bin->count++] = ptr;
+	return 1;
+}
+
+// The cache is empty. Take half a cache's worth from the class, return
+// one and push the rest. Whatever no longer fits, because other threads
+// on this CPU filled the cache in the meantime, goes back to the class.
+static void *cache_refill(unsigned int class_idx)
+{
+	void *objs[SLAB_CACHE_OBJS / 2];
+	size_t num = class_alloc_bulk(class_idx, objs, SLAB_CACHE_OBJS / 2);
+	if (num == 0) {
+		return NULL;
+	}
+	size_t i = 1;
+	while (i < num && cache_push(class_idx, objs[i])) {
+		++i;
+	}
+	if (i < num) {
+		class_free_bulk(class_idx, &objs[i], num - i);
+	}
+	return objs[0];
+}
+
+// The cache is full. Take half of it out, push ptr and give the half back
+// to the class in one lock hold.
+static void cache_flush(unsigned int class_idx, void *ptr)
+{
+	void *objs[SLAB_CACHE_OBJS / 2 + 1];
+	size_t num = 0;
+	while (num < SLAB_CACHE_OBJS / 2 && cache_pop(class_idx, &objs[num])) {
+		++num;
+	}
+	if (!cache_push(class_idx, ptr)) {
+		objs[num++] = ptr;
+	}
+	class_free_bulk(class_idx, objs, num);
+}
+
+// This thread's cache, given back to the classes when the thread exits
+static inline struct slab_cache *thread_cache_get()
+{
+	if (unlikely(!thread_cache_used)) {
+		thread_cache_used = 1;
+		pthread_setspecific(thread_cache_key, &thread_cache);
+	}
+	return &thread_cache;
+}
+
+static void thread_cache_flush(void *cache)
+{
+	struct slab_cache *c = cache;
+	for (unsigned int i = 0; i < SLAB_CLASS_NUM; ++i) {
+		class_free_bulk(i, c->bins[i].objs, c->bins[i].count);
+		c->bins[i].count = 0;
+	}
+}
+
+static unsigned int size_to_class(size_t size)
+{
+	if (likely(size <= SLAB_LOOKUP_MAX)) {
+		return small_class[(size + 7) / 8];
+	}
+	unsigned int class_idx = small_class[SLAB_LOOKUP_MAX / 8];
+	while (class_sizes[class_idx] < size) {
+		++class_idx;
+	}
+	return class_idx;
+}
+
+// Take up to num objects from the class under one lock hold. Returns how
+// many were taken, which is only short if palloc fails.
+static size_t class_alloc_bulk(unsigned int class_idx, void **objs,
+			       size_t num)
+{
+	struct slab_class *class = &classes[class_idx];
+	size_t taken = 0;
+	pthread_mutex_lock(&class->lock);
+	while (taken < num) {
+		if (unlikely(list_empty(&class->partial_head))) {
+			struct slab *slab = class->empty;
+			class->empty = NULL;
+			if (slab == NULL) {
+				slab = slab_create(class_idx);
+				if (slab == NULL) {
+					break;
+				}
+			}
+			dlist_add(&slab->slabs_head, &class->partial_head);
+		}
+		struct slab *slab = list_entry(class->partial_head.next,
+					       struct slab, slabs_head);
+		// Take as much as the slab has in one pass over its bitmap
+		uint32_t idx[SLAB_CACHE_OBJS];
+		size_t want = num - taken;
+		if (want > SLAB_CACHE_OBJS) {
+			want = SLAB_CACHE_OBJS;
+		}
+		size_t got = bitmap_take(slab_bitmap(slab), class->words,
+					 &slab->hint, idx, want);
+		uintptr_t data = (uintptr_t)slab + class->data_offset;
+		for (size_t i = 0; i < got; ++i) {
+			objs[taken++] = (void *)(data + (uintptr_t)idx[i] *
+							class_sizes[class_idx]);
+		}
+		slab->used += got;
+		if (slab->used == class->objs) {
+			dlist_del(&slab->slabs_head);
+			dlist_add(&slab->slabs_head, &class->full_head);
+		}
+	}
+	pthread_mutex_unlock(&class->lock);
+	return taken;
+}
+
+// Give num objects back to the class under one lock hold
+static void class_free_bulk(unsigned int class_idx, void **objs, size_t num)
+{
+	struct slab_class *class = &classes[class_idx];
+	// Slabs that empty out go back to palloc after the lock is dropped
+	DLIST_HEAD(to_free);
+	pthread_mutex_lock(&class->lock);
+	for (size_t i = 0; i < num; ++i) {
+		void *ptr = objs[i];
+		struct slab *slab = slab_of(ptr);
+		uintptr_t offset = (uintptr_t)ptr - (uintptr_t)slab -
+				   class->data_offset;
+		size_t idx = (offset * class->recip) >> 32;
+		bitmap_set(slab_bitmap(slab), idx);
+		if (idx / BITMAP_WORD_BITS < slab->hint) {
+			slab->hint = idx / BITMAP_WORD_BITS;
+		}
+		if (unlikely(slab->used-- == class->objs)) {
+			dlist_del(&slab->slabs_head);
+			dlist_add(&slab->slabs_head, &class->partial_head);
+		}
+		if (unlikely(slab->used == 0)) {
+			dlist_del(&slab->slabs_head);
+			if (class->empty == NULL) {
+				slab_reset(slab);
+				class->empty = slab;
+			} else {
+				dlist_add(&slab->slabs_head, &to_free);
+			}
+		}
+	}
+	pthread_mutex_unlock(&class->lock);
+	while (!list_empty(&to_free)) {
+		struct dlink *l = to_free.next;
+		dlist_del(l);
+		pfree(list_entry(l, struct slab, slabs_head));
+	}
+}
+
+static struct slab *slab_create(unsigned int class_idx)
+{
+	struct slab *slab = palloc_aligned(slab_pages(), slab_pages());
+	if (slab == NULL) {
+		return NULL;
+	}
+	slab->kind = SLAB_KIND_SMALL;
+	slab->class_idx = class_idx;
+	slab_reset(slab);
+	return slab;
+}
+
+// Only the bitmap is written, the objects themselves are never walked
+static void slab_reset(struct slab *slab)
+{
+	struct slab_class *class = &classes[slab->class_idx];
+	bitmap_fill(slab_bitmap(slab), class->words, class->objs);
+	slab->hint = 0;
+	slab->used = 0;
+}
+
+static inline uint64_t *slab_bitmap(struct slab *slab)
+{
+	return (uint64_t *)((uintptr_t)slab + SLAB_HEADER_SIZE);
+}
+
+static void *large_alloc(size_t size)
+{
+	size_t ps = page_size();
+	// Rounding up below would wrap
+	if (unlikely(size > SIZE_MAX - SLAB_HEADER_SIZE - ps)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size_t pnum = (size + SLAB_HEADER_SIZE + ps - 1) / ps;
+	struct slab *slab = palloc_aligned(pnum, slab_pages());
+	if (slab == NULL) {
+		return NULL;
+	}
+	slab->kind = SLAB_KIND_LARGE;
+	slab->used = pnum;
+	return (void *)((uintptr_t)slab + SLAB_HEADER_SIZE);
+}
+
+static inline struct slab *slab_of(void *ptr)
+{
+	return (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_BYTES - 1));
+}
+
+static size_t slab_pages()
+{
+	size_t pages = SLAB_BYTES / page_size();
+	return pages == 0 ? 1 : pages;
+}
@@ -0,0 +1,38 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stddef.h>
+
+/* A general purpose allocator for small objects. Requests are rounded up
+ * to one of SLAB_CLASS_NUM size classes and each class carves objects out
+ * of its own slabs. Slabs come from palloc_aligned so the slab header of
+ * any object is found by masking its address. Requests bigger than the
+ * largest class go straight to palloc. Free objects in a slab are tracked
+ * in a bitmap after its header (see bitmap.h). All functions are thread
+ * safe.
+ *
+ * Each CPU has a small cache of free objects per class in front of the
+ * classes, so most calls never touch a class lock. Pushes and pops on it
+ * are rseq critical sections, which the kernel restarts if the thread is
+ * preempted or migrated halfway, so the caches take no lock at all. On
+ * targets other than x86-64, in ThreadSanitizer builds, or where the
+ * kernel or libc has no rseq, the caches are per thread instead.
+ */
+
+#define SLAB_CLASS_NUM 40
+// Largest request served from a slab
+#define SLAB_SIZE_MAX 16384
+
+// Same contract as malloc
+void *salloc(size_t size);
+
+// Same contract as free
+void sfree(void *ptr);
+
+// Same contract as realloc
+void *srealloc(void *ptr, size_t size);
+
+// Number of bytes usable at ptr, at least the size it was allocated with
+size_t susable_size(void *ptr);
+
+#endif // _SLAB_H
@@ -0,0 +1,67 @@
+#include <errno.h>
+#include <stdint.h>
+
+#include "page.h"
+#include "stack.h"
+
+// Commit at least this much at a time to keep mprotect calls rare
+#define COMMIT_BYTES_MIN (64 * 1024)
+
+int stack_init(struct stack *stack, size_t reserve_bytes)
+{
+	int ps = page_size();
+	size_t num_pages = (reserve_bytes + ps - 1) / ps;
+	void *base = preserve(num_pages);
+	if (base == NULL) {
+		return -1;
+	}
+	stack->base = (uintptr_t)base;
+	stack->top = stack->base;
+	stack->committed = stack->base;
+	stack->end = stack->base + num_pages * ps;
+	stack->last = NULL;
+	return 0;
+}
+
+int stack_grow(struct stack *stack, uintptr_t top)
+{
+	if (top > stack->end) {
+		errno = ENOMEM;
+		return -1;
+	}
+	int ps = page_size();
+	uintptr_t committed = stack->committed + COMMIT_BYTES_MIN;
+	if (committed < top) {
+		committed = top;
+	}
+	committed = (committed + ps - 1) & ~(uintptr_t)(ps - 1);
+	if (committed > stack->end) {
+		committed = stack->end;
+	}
+	if (pcommit((void *)stack->committed,
+		    (committed - stack->committed) / ps) != 0) {
+		return -1;
+	}
+	stack->committed = committed;
+	return 0;
+}
+
+int stack_pop(struct stack *stack, void *ptr)
+{
+	if (ptr == NULL || ptr != stack->last) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct stack_header *header =
+		(struct stack_header *)((uintptr_t)ptr - sizeof(*header));
+	stack->top = (uintptr_t)header;
+	stack->last = header->prev;
+	return 0;
+}
+
+void stack_destroy(struct stack *stack)
+{
+	prelease((void *)stack->base, (stack->end - stack->base) / page_size());
+	stack->base = stack->top = stack->committed = stack->end = 0;
+	stack->last = NULL;
+}
@@ -0,0 +1,86 @@
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A LIFO allocator. Allocations are pushed onto a stack in reserved
+ * address space that is committed as it is used, so the stack can be as
+ * deep as the reservation without the risk alloca has. stack_pop frees
+ * the top allocation and frames free everything pushed since they began.
+ * Not thread safe.
+ */
+
+#define STACK_ALIGN 16
+
+struct stack {
+	uintptr_t base;
+	// Next free byte
+	uintptr_t top;
+	// End of the committed and reserved parts
+	uintptr_t committed;
+	uintptr_t end;
+	// Most recent allocation, used to check stack_pop
+	void *last;
+};
+
+// Everything pushed after a frame begins is freed when it ends
+struct stack_frame {
+	uintptr_t top;
+	void *last;
+};
+
+// Stored before every allocation so stack_pop knows the one below it
+struct stack_header {
+	void *prev;
+	size_t pad;
+};
+
+// Reserve reserve_bytes of address space for the stack. Returns 0 on
+// success or -1 with errno set.
+int stack_init(struct stack *stack, size_t reserve_bytes);
+
+// Commit more of the reservation. Used by stack_push.
+int stack_grow(struct stack *stack, uintptr_t top);
+
+// Push bytes onto the stack. Returns NULL once the reservation is used up.
+static inline void *stack_push(struct stack *stack, size_t bytes)
+{
+	uintptr_t ptr = stack->top + sizeof(struct stack_header);
+	// Checked before rounding so a huge bytes can't wrap around
+	if (ptr > stack->end || bytes > stack->end - ptr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	uintptr_t top = ptr + ((bytes + STACK_ALIGN - 1) &
+			       ~(uintptr_t)(STACK_ALIGN - 1));
+	if (top > stack->committed && stack_grow(stack, top) != 0) {
+		return NULL;
+	}
+	((struct stack_header *)stack->top)->prev = stack->last;
+	stack->top = top;
+	stack->last = (void *)ptr;
+	return (void *)ptr;
+}
+
+// Free the top allocation. Returns 0 on success or -1 with errno set to
+// EINVAL if ptr is not the top allocation.
+int stack_pop(struct stack *stack, void *ptr);
+
+static inline struct stack_frame stack_frame_begin(struct stack *stack)
+{
+	struct stack_frame frame = { .top = stack->top, .last = stack->last };
+	return frame;
+}
+
+static inline void stack_frame_end(struct stack *stack,
+				   struct stack_frame frame)
+{
+	stack->top = frame.top;
+	stack->last = frame.last;
+}
+
+void stack_destroy(struct stack *stack);
+
+#endif // _STACK_H
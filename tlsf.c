@@ -0,0 +1,254 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "page.h"
+#include "tlsf.h"
+#include "__utils.h"
+
+/* Every block starts with this header. The free list links overlap the
+ * start of the payload so they only exist while the block is free. The
+ * region ends with a zero sized used block so coalescing stops there.
+ */
+struct tlsf_block {
+	struct tlsf_block *prev_phys;
+	// Payload size, low bits are flags
+	size_t size;
+	struct tlsf_block *next_free;
+	struct tlsf_block *prev_free;
+};
+
+#define BLOCK_FREE 0x1
+#define BLOCK_OVERHEAD offsetof(struct tlsf_block, next_free)
+#define BLOCK_SIZE_MIN (sizeof(struct tlsf_block) - BLOCK_OVERHEAD)
+#define SMALL_BLOCK_SIZE ((size_t)1 << TLSF_FL_SHIFT)
+
+static inline size_t block_size(struct tlsf_block *block);
+static inline int block_is_free(struct tlsf_block *block);
+static inline struct tlsf_block *block_next(struct tlsf_block *block);
+static inline struct tlsf_block *block_from_ptr(void *ptr);
+static inline void *block_to_ptr(struct tlsf_block *block);
+static inline int fls_size(size_t size);
+static inline void mapping_insert(size_t size, int *fl, int *sl);
+static inline void mapping_search(size_t size, int *fl, int *sl);
+static inline struct tlsf_block *find_suitable(struct tlsf *tlsf, int *fl,
+					       int *sl);
+static inline void remove_free(struct tlsf *tlsf, struct tlsf_block *block,
+			       int fl, int sl);
+static inline void insert_free(struct tlsf *tlsf, struct tlsf_block *block);
+
+int tlsf_init(struct tlsf *tlsf, void *region, size_t bytes)
+{
+	memset(tlsf, 0, sizeof(*tlsf));
+	if (region == NULL) {
+		int ps = page_size();
+		size_t num_pages = (bytes + ps - 1) / ps;
+		region = palloc(num_pages);
+		if (region == NULL) {
+			return -1;
+		}
+		bytes = num_pages * ps;
+		tlsf->region = region;
+	}
+	uintptr_t start = ((uintptr_t)region + TLSF_ALIGN - 1) &
+			  ~(uintptr_t)(TLSF_ALIGN - 1);
+	uintptr_t end = ((uintptr_t)region + bytes) &
+			~(uintptr_t)(TLSF_ALIGN - 1);
+	if (end < start + 2 * BLOCK_OVERHEAD + BLOCK_SIZE_MIN ||
+	    end - start >= ((size_t)1 << TLSF_FL_MAX_SHIFT)) {
+		if (tlsf->region != NULL) {
+			pfree(tlsf->region);
+		}
+		errno = EINVAL;
+		return -1;
+	}
+	struct tlsf_block *block = (struct tlsf_block *)start;
+	block->prev_phys = NULL;
+	block->size = (end - start - 2 * BLOCK_OVERHEAD) | BLOCK_FREE;
+	struct tlsf_block *sentinel = block_next(block);
+	sentinel->prev_phys = block;
+	sentinel->size = 0;
+	insert_free(tlsf, block);
+	return 0;
+}
+
+void *tlsf_alloc(struct tlsf *tlsf, size_t bytes)
+{
+	if (unlikely(bytes >= ((size_t)1 << (TLSF_FL_MAX_SHIFT - 1)))) {
+		return NULL;
+	}
+	size_t size = (bytes + TLSF_ALIGN - 1) & ~(size_t)(TLSF_ALIGN - 1);
+	if (size < BLOCK_SIZE_MIN) {
+		size = BLOCK_SIZE_MIN;
+	}
+	int fl, sl;
+	mapping_search(size, &fl, &sl);
+	struct tlsf_block *block = find_suitable(tlsf, &fl, &sl);
+	if (block == NULL) {
+		return NULL;
+	}
+	remove_free(tlsf, block, fl, sl);
+	// Split off the tail if it can hold a block of its own
+	size_t remaining = block_size(block) - size;
+	if (remaining >= BLOCK_OVERHEAD + BLOCK_SIZE_MIN) {
+		struct tlsf_block *rest =
+			(struct tlsf_block *)((uintptr_t)block_to_ptr(block) +
+					      size);
+		rest->prev_phys = block;
+		rest->size = (remaining - BLOCK_OVERHEAD) | BLOCK_FREE;
+		block_next(rest)->prev_phys = rest;
+		block->size = size;
+		insert_free(tlsf, rest);
+	} else {
+		block->size = block_size(block);
+	}
+	return block_to_ptr(block);
+}
+
+void tlsf_free(struct tlsf *tlsf, void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	struct tlsf_block *block = block_from_ptr(ptr);
+	int fl, sl;
+	struct tlsf_block *prev = block->prev_phys;
+	if (prev != NULL && block_is_free(prev)) {
+		mapping_insert(block_size(prev), &fl, &sl);
+		remove_free(tlsf, prev, fl, sl);
+		prev->size = block_size(prev) + BLOCK_OVERHEAD +
+			     block_size(block);
+		block = prev;
+	}
+	struct tlsf_block *next = block_next(block);
+	if (block_is_free(next)) {
+		mapping_insert(block_size(next), &fl, &sl);
+		remove_free(tlsf, next, fl, sl);
+		block->size = block_size(block) + BLOCK_OVERHEAD +
+			      block_size(next);
+	}
+	block_next(block)->prev_phys = block;
+	block->size |= BLOCK_FREE;
+	insert_free(tlsf, block);
+}
+
+size_t tlsf_usable_size(void *ptr)
+{
+	return block_size(block_from_ptr(ptr));
+}
+
+void tlsf_destroy(struct tlsf *tlsf)
+{
+	if (tlsf->region != NULL) {
+		pfree(tlsf->region);
+		tlsf->region = NULL;
+	}
+}
+
+static inline size_t block_size(struct tlsf_block *block)
+{
+	return block->size & ~(size_t)(TLSF_ALIGN - 1);
+}
+
+static inline int block_is_free(struct tlsf_block *block)
+{
+	return block->size & BLOCK_FREE;
+}
+
+static inline struct tlsf_block *block_next(struct tlsf_block *block)
+{
+	return (struct tlsf_block *)((uintptr_t)block_to_ptr(block) +
+				     block_size(block));
+}
+
+static inline struct tlsf_block *block_from_ptr(void *ptr)
+{
+	return (struct tlsf_block *)((uintptr_t)ptr - BLOCK_OVERHEAD);
+}
+
+static inline void *block_to_ptr(struct tlsf_block *block)
+{
+	return (void *)((uintptr_t)block + BLOCK_OVERHEAD);
+}
+
+// Index of the most significant set bit
+static inline int fls_size(size_t size)
+{
+	return (int)(sizeof(size) * 8 - 1) - __builtin_clzl(size);
+}
+
+static inline void mapping_insert(size_t size, int *fl, int *sl)
+{
+	if (size < SMALL_BLOCK_SIZE) {
+		*fl = 0;
+		*sl = size / (SMALL_BLOCK_SIZE / TLSF_SL_COUNT);
+		return;
+	}
+	int msb = fls_size(size);
+	*sl = (size >> (msb - TLSF_SL_SHIFT)) ^ TLSF_SL_COUNT;
+	*fl = msb - (TLSF_FL_SHIFT - 1);
+}
+
+// Round size up to the next list so any block found there is big enough
+static inline void mapping_search(size_t size, int *fl, int *sl)
+{
+	if (size >= SMALL_BLOCK_SIZE) {
+		size += ((size_t)1 << (fls_size(size) - TLSF_SL_SHIFT)) - 1;
+	}
+	mapping_insert(size, fl, sl);
+}
+
+static inline struct tlsf_block *find_suitable(struct tlsf *tlsf, int *fl,
+					       int *sl)
+{
+	uint32_t sl_map = tlsf->sl_bitmap[*fl] & (~0U << *sl);
+	if (sl_map == 0) {
+		// Nothing left in this first level, go up to the next one
+		uint32_t fl_map = *fl + 1 >= 32 ?
+					  0 :
+					  tlsf->fl_bitmap & (~0U << (*fl + 1));
+		if (fl_map == 0) {
+			return NULL;
+		}
+		*fl = __builtin_ctz(fl_map);
+		sl_map = tlsf->sl_bitmap[*fl];
+	}
+	*sl = __builtin_ctz(sl_map);
+	return tlsf->blocks[*fl][*sl];
+}
+
+static inline void remove_free(struct tlsf *tlsf, struct tlsf_block *block,
+			       int fl, int sl)
+{
+	struct tlsf_block *prev = block->prev_free;
+	struct tlsf_block *next = block->next_free;
+	if (next != NULL) {
+		next->prev_free = prev;
+	}
+	if (prev != NULL) {
+		prev->next_free = next;
+		return;
+	}
+	tlsf->blocks[fl][sl] = next;
+	if (next == NULL) {
+		tlsf->sl_bitmap[fl] &= ~(1U << sl);
+		if (tlsf->sl_bitmap[fl] == 0) {
+			tlsf->fl_bitmap &= ~(1U << fl);
+		}
+	}
+}
+
+static inline void insert_free(struct tlsf *tlsf, struct tlsf_block *block)
+{
+	int fl, sl;
+	mapping_insert(block_size(block), &fl, &sl);
+	struct tlsf_block *head = tlsf->blocks[fl][sl];
+	block->next_free = head;
+	block->prev_free = NULL;
+	if (head != NULL) {
+		head->prev_free = block;
+	}
+	tlsf->blocks[fl][sl] = block;
+	tlsf->fl_bitmap |= 1U << fl;
+	tlsf->sl_bitmap[fl] |= 1U << sl;
+}
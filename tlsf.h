@@ -0,0 +1,49 @@
+#ifndef _TLSF_H
+#define _TLSF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Two level segregated fit allocator. Free blocks are kept in lists
+ * indexed first by the power of two of their size and then by one of
+ * TLSF_SL_COUNT linear steps within it. A bitmap per level means the list
+ * to allocate from is found with two find first set instructions, and
+ * free blocks are coalesced with their physical neighbours right away.
+ * tlsf_alloc and tlsf_free are O(1) with a small bounded cost, which is
+ * what real time threads need. Not thread safe.
+ */
+
+#define TLSF_ALIGN 16
+#define TLSF_SL_SHIFT 5
+#define TLSF_SL_COUNT (1 << TLSF_SL_SHIFT)
+// Blocks smaller than 1 << TLSF_FL_SHIFT all live in the first level
+#define TLSF_FL_SHIFT (TLSF_SL_SHIFT + 4)
+// Largest block is just under 1 << TLSF_FL_MAX_SHIFT bytes
+#define TLSF_FL_MAX_SHIFT 38
+#define TLSF_FL_COUNT (TLSF_FL_MAX_SHIFT - TLSF_FL_SHIFT + 1)
+
+struct tlsf_block;
+
+struct tlsf {
+	uint32_t fl_bitmap;
+	uint32_t sl_bitmap[TLSF_FL_COUNT];
+	struct tlsf_block *blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+	// Region to give back to palloc, or NULL if the caller owns it
+	void *region;
+};
+
+// Manage bytes of memory at region, or palloc the region if it is NULL.
+// Returns 0 on success or -1 with errno set.
+int tlsf_init(struct tlsf *tlsf, void *region, size_t bytes);
+
+// Returns a TLSF_ALIGN aligned block or NULL if none is big enough
+void *tlsf_alloc(struct tlsf *tlsf, size_t bytes);
+
+void tlsf_free(struct tlsf *tlsf, void *ptr);
+
+// Number of bytes usable at ptr
+size_t tlsf_usable_size(void *ptr);
+
+void tlsf_destroy(struct tlsf *tlsf);
+
+#endif // _TLSF_H